@@ -0,0 +1,182 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Times Cache::saveState on a synthetic account with 500 joined rooms: the
+// initial sync, then incremental syncs with a new message in every room.
+
+#include <cstdio>
+#include <string>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStandardPaths>
+#include <json.hpp>
+#include <mtx/responses.hpp>
+
+#include "Cache.h"
+
+using json = nlohmann::json;
+
+//! Number of joined rooms of the synthetic account.
+constexpr int ROOMS = 500;
+//! Number of members of each room.
+constexpr int MEMBERS = 20;
+//! Number of messages in the timeline of the initial sync.
+constexpr int MESSAGES = 10;
+//! Number of incremental syncs that are timed.
+constexpr int SYNCS = 20;
+
+static const std::string LOCAL_USER = "@benchmark:localhost";
+
+static json
+event(const std::string &type, const std::string &sender, json content, int counter)
+{
+        return {{"type", type},
+                {"event_id", "$" + std::to_string(counter) + ":localhost"},
+                {"sender", sender},
+                {"origin_server_ts", 1500000000000 + counter},
+                {"content", std::move(content)}};
+}
+
+static json
+stateEvent(const std::string &type,
+           const std::string &sender,
+           const std::string &state_key,
+           json content,
+           int counter)
+{
+        auto e         = event(type, sender, std::move(content), counter);
+        e["state_key"] = state_key;
+
+        return e;
+}
+
+static std::string
+roomId(int room)
+{
+        return "!room" + std::to_string(room) + ":localhost";
+}
+
+static std::string
+userId(int member)
+{
+        return member == 0 ? LOCAL_USER : "@user" + std::to_string(member) + ":localhost";
+}
+
+//! A sync with the given state & timeline events in every room.
+static mtx::responses::Sync
+makeSync(int batch, bool initial)
+{
+        const auto empty = json::object();
+        const auto none  = json{{"events", json::array()}};
+
+        int counter = batch * 100000;
+
+        json join = json::object();
+
+        for (int room = 0; room < ROOMS; ++room) {
+                json state    = json::array();
+                json timeline = json::array();
+
+                if (initial) {
+                        state.push_back(stateEvent(
+                          "m.room.create", userId(0), "", {{"creator", userId(0)}}, counter++));
+                        state.push_back(stateEvent("m.room.name",
+                                                   userId(0),
+                                                   "",
+                                                   {{"name", "Room " + std::to_string(room)}},
+                                                   counter++));
+
+                        for (int member = 0; member < MEMBERS; ++member)
+                                state.push_back(stateEvent(
+                                  "m.room.member",
+                                  userId(member),
+                                  userId(member),
+                                  {{"membership", "join"},
+                                   {"displayname", "User " + std::to_string(member)}},
+                                  counter++));
+                }
+
+                const int messages = initial ? MESSAGES : 1;
+                for (int i = 0; i < messages; ++i)
+                        timeline.push_back(event("m.room.message",
+                                                 userId(i % MEMBERS),
+                                                 {{"msgtype", "m.text"}, {"body", "message"}},
+                                                 counter++));
+
+                join[roomId(room)] = {
+                  {"state", {{"events", state}}},
+                  {"timeline",
+                   {{"events", timeline},
+                    {"limited", false},
+                    {"prev_batch", "p" + std::to_string(batch)}}},
+                  {"ephemeral", none},
+                  {"account_data", none},
+                  {"unread_notifications", {{"highlight_count", 0}, {"notification_count", 0}}}};
+        }
+
+        json response = {{"next_batch", "s" + std::to_string(batch + 1)},
+                         {"rooms", {{"join", join}, {"invite", empty}, {"leave", empty}}},
+                         {"account_data", none},
+                         {"presence", none}};
+
+        return response;
+}
+
+int
+main(int argc, char *argv[])
+{
+        QCoreApplication app(argc, argv);
+        QCoreApplication::setApplicationName("nheko-benchmark");
+
+        // Keep the cache of the benchmark away from the real ones.
+        QStandardPaths::setTestModeEnabled(true);
+
+        Cache cache(QString::fromStdString(LOCAL_USER));
+
+        // Start from an empty cache.
+        cache.setup();
+        cache.deleteData();
+        cache.setup();
+        cache.setCurrentFormat();
+
+        QElapsedTimer timer;
+
+        const auto initial = makeSync(0, true);
+
+        timer.start();
+        cache.saveState(initial);
+        const auto initialTime = timer.nsecsElapsed();
+
+        qint64 total = 0;
+        for (int batch = 1; batch <= SYNCS; ++batch) {
+                const auto sync = makeSync(batch, false);
+
+                timer.start();
+                cache.saveState(sync);
+                total += timer.nsecsElapsed();
+        }
+
+        std::printf("rooms: %d\n", ROOMS);
+        std::printf("initial sync: %.1f ms\n", initialTime / 1e6);
+        std::printf("incremental sync: %.2f ms (average of %d)\n", total / 1e6 / SYNCS, SYNCS);
+
+        cache.deleteData();
+
+        return 0;
+}
@@ -17,12 +17,28 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
 #include <QDebug>
 #include <QDir>
+#include <QMap>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
 #include <json.hpp>
 #include <lmdb++.h>
 #include <mtx/responses.hpp>
 
+#include "CacheWriter.h"
+#include "MediaCache.h"
+#include "MemberDirectory.h"
+#include "ReadTxnPool.h"
+#include "SearchIndex.h"
 #include "Utils.h"
 
 struct SearchResult
@@ -35,6 +51,8 @@ Q_DECLARE_METATYPE(SearchResult)
 Q_DECLARE_METATYPE(QVector<SearchResult>)
 
 //! Used to uniquely identify a list of read receipts.
+//!
+//! Only used to migrate the receipts saved in the JSON format.
 struct ReadReceiptKey
 {
         std::string event_id;
@@ -106,48 +124,194 @@ from_json(const json &j, MemberInfo &info)
         info.avatar_url = j.at("avatar_url");
 }
 
+//! Persisted summary of a joined room.
+//!
+//! Keeps what is needed to calculate the name & avatar of the room, so they
+//! can be updated without scanning the members.
+struct RoomSummary
+{
+        //! Where the calculated room name comes from.
+        enum class NameSource : uint8_t
+        {
+                Members,
+                Name,
+                CanonicalAlias,
+        };
+
+        //! Where the calculated room avatar comes from.
+        enum class AvatarSource : uint8_t
+        {
+                None,
+                Room,
+                Member,
+        };
+
+        //! Number of joined & invited members.
+        uint64_t member_count = 0;
+        //! The first members other than the local user.
+        std::vector<std::string> heroes;
+        NameSource name_source     = NameSource::Members;
+        AvatarSource avatar_source = AvatarSource::None;
+};
+
+//! What the room list shows for a joined room.
+//!
+//! Saved so the room list can be painted & ordered on startup, before the
+//! timelines are loaded.
+struct RoomListEntry
+{
+        //! The sender of the last message.
+        std::string user_id;
+        //! How the sender is shown in the list.
+        std::string username;
+        //! Preview of the last message.
+        std::string body;
+        //! Time of the last message in milliseconds. The list is ordered by it.
+        uint64_t timestamp = 0;
+        //! Number of unread notifications.
+        uint64_t unread_count = 0;
+};
+
+//! Binary representation of the cached records.
+//!
+//! A record starts with the version of its layout, followed by its fields.
+//! Strings are prefixed by their length as a 32-bit little-endian integer.
+//! The decoders read straight from the memory mapped value and return
+//! false for malformed or unknown records.
+namespace record {
+
+std::string
+encode(const RoomInfo &info);
+std::string
+encode(const MemberInfo &info);
+std::string
+encode(const RoomSummary &summary);
+std::string
+encode(const RoomListEntry &entry);
+
+bool
+decode(const lmdb::val &data, RoomInfo &info);
+bool
+decode(const lmdb::val &data, MemberInfo &info);
+bool
+decode(const lmdb::val &data, RoomSummary &summary);
+bool
+decode(const lmdb::val &data, RoomListEntry &entry);
+}
+
 Q_DECLARE_METATYPE(RoomInfo)
+Q_DECLARE_METATYPE(mtx::responses::Timeline)
+
+//! In-memory copy of the room info of the joined rooms & the invites.
+//!
+//! Serves the room list, the quick switcher & the room switches without
+//! reading the cache. The writes stage their changes, which are applied
+//! only after the transaction commits, so the table never shows data that
+//! was rolled back.
+class RoomInfoTable
+{
+public:
+        using Rooms = QMap<QString, RoomInfo>;
+        //! Read the joined rooms & the invites from the cache.
+        using Loader = std::function<void(Rooms &joined, Rooms &invites)>;
+
+        void setLoader(Loader loader);
+        //! Drop the contents. They are loaded again on the next lookup.
+        void clear();
+
+        //! The joined rooms & the invites. An invite hides a joined room
+        //! with the same id.
+        Rooms all();
+        Rooms joined();
+        //! Look up a room. A joined room hides an invite with the same id.
+        bool find(const QString &room_id, RoomInfo &info);
+
+        //! Stage a change. It becomes visible after commit().
+        void putRoom(const QString &room_id, const RoomInfo &info);
+        void removeRoom(const QString &room_id);
+        void putInvite(const QString &room_id, const RoomInfo &info);
+        void removeInvite(const QString &room_id);
+
+        //! Apply the changes of the transaction that just committed.
+        void commit();
+        //! Drop the changes of a transaction that failed.
+        void discard();
+
+private:
+        struct Change
+        {
+                QString room_id;
+                RoomInfo info;
+                bool invite;
+                bool removed;
+        };
+
+        //! Load the rooms if they aren't loaded yet. Requires the lock.
+        void load();
+        //! Update the combined entry of the room. Requires the lock.
+        void refresh(const QString &room_id);
+
+        std::mutex mutex_;
+        bool loaded_ = false;
+        Rooms joined_;
+        Rooms invites_;
+        Rooms all_;
+        Loader loader_;
+
+        //! Only used by the writer thread.
+        std::vector<Change> pending_;
+};
 
 class Cache : public QObject
 {
         Q_OBJECT
 
 public:
+        //! How the commits are flushed to disk.
+        enum class Durability
+        {
+                //! Every commit is synced.
+                Safe,
+                //! The commits aren't synced; the environment is synced
+                //! periodically & on shutdown.
+                Batched,
+                //! Nothing is synced. Only meant for benchmarks.
+                Ephemeral,
+        };
+
         Cache(const QString &userId, QObject *parent = nullptr);
+        ~Cache();
 
-        static QHash<QString, QString> DisplayNames;
-        static QHash<QString, QString> AvatarUrls;
+        //! Display names & avatars of the members of the joined rooms.
+        static MemberDirectory Members;
 
         static std::string displayName(const std::string &room_id, const std::string &user_id);
-        static QString displayName(const QString &room_id, const QString &user_id);
-        static QString avatarUrl(const QString &room_id, const QString &user_id);
-
-        static void removeDisplayName(const QString &room_id, const QString &user_id);
-        static void removeAvatarUrl(const QString &room_id, const QString &user_id);
-
-        static void insertDisplayName(const QString &room_id,
-                                      const QString &user_id,
-                                      const QString &display_name);
-        static void insertAvatarUrl(const QString &room_id,
-                                    const QString &user_id,
-                                    const QString &avatar_url);
+        static QString displayName(const QString &room_id, const QString &user_id)
+        {
+                return Members.displayName(room_id, user_id);
+        }
+        static QString avatarUrl(const QString &room_id, const QString &user_id)
+        {
+                return Members.avatarUrl(room_id, user_id);
+        }
 
-        //! Load saved data for the display names & avatars.
-        void populateMembers();
+        //! Read the members of a room for the member directory.
+        bool loadMembers(const std::string &room_id, MemberDirectory::Members &members);
         std::vector<std::string> joinedRooms();
 
         QMap<QString, RoomInfo> roomInfo(bool withInvites = true);
         std::map<QString, bool> invites();
 
         //! Calculate & return the name of the room.
-        QString getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
+        //!
+        //! The source of the name & avatar is recorded in the summary.
+        QString getRoomName(lmdb::txn &txn, const std::string &room_id, RoomSummary &summary);
         //! Retrieve the topic of the room if any.
-        QString getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb);
+        QString getRoomTopic(lmdb::txn &txn, const std::string &room_id);
         //! Retrieve the room avatar's url if any.
         QString getRoomAvatarUrl(lmdb::txn &txn,
-                                 lmdb::dbi &statesdb,
-                                 lmdb::dbi &membersdb,
-                                 const QString &room_id);
+                                 const std::string &room_id,
+                                 RoomSummary &summary);
 
         void saveState(const mtx::responses::Sync &res);
         bool isInitialized() const;
@@ -155,28 +319,48 @@ public:
         QString nextBatchToken() const;
 
         void deleteData();
+        //! Commit the queued writes & flush them to disk.
+        void flush();
 
         void removeInvite(lmdb::txn &txn, const std::string &room_id);
         void removeInvite(const std::string &room_id);
         void removeRoom(lmdb::txn &txn, const std::string &roomid);
         void removeRoom(const std::string &roomid);
         void removeRoom(const QString &roomid) { removeRoom(roomid.toStdString()); };
+        //! Remove the rows & databases of the rooms that are neither joined nor invites.
+        //!
+        //! Rooms left by older versions kept some of their data. The rows are
+        //! removed in batches through the writer, so this can run while the
+        //! cache is in use. Returns the reclaimed space in bytes.
+        uint64_t collectGarbage();
         void setup();
 
         bool isFormatValid();
         void setCurrentFormat();
+        //! Whether the stored format can be upgraded to the current one.
+        bool needsMigration();
+        //! Upgrade the records saved by a previous format version in place.
+        //!
+        //! Each step runs in its own transaction & records the format version it
+        //! upgraded to, so an interrupted upgrade resumes from the last step.
+        //! Formats without a migration path are left to be reset.
+        void runMigrations();
 
         //! Retrieves the saved room avatar.
         QImage getRoomAvatar(const QString &id);
+        //! Retrieves the avatar of an already loaded room info.
+        QImage getRoomAvatar(const RoomInfo &info);
 
         //! Adds a user to the read list for the given event.
         //!
         //! There should be only one user id present in a receipt list per room.
-        //! The user id should be removed from any other lists.
+        //! The user id is removed from any other lists.
         using Receipts = std::map<std::string, std::map<std::string, uint64_t>>;
         void updateReadReceipt(lmdb::txn &txn,
                                const std::string &room_id,
                                const Receipts &receipts);
+        //! Remove all the read receipts of the room.
+        void removeReadReceipts(lmdb::txn &txn, const std::string &room_id);
 
         //! Retrieve all the read receipts for the given event id and room.
         //!
@@ -186,9 +370,13 @@ public:
 
         QByteArray image(const QString &url) const;
         void saveImage(const QString &url, const QByteArray &data);
+        //! Usage counters of the media cache.
+        MediaCache::Statistics mediaStatistics() const;
 
         std::vector<std::string> roomsWithStateUpdates(const mtx::responses::Sync &res);
         std::map<QString, RoomInfo> getRoomInfo(const std::vector<std::string> &rooms);
+        std::map<QString, RoomInfo> getRoomInfo(lmdb::txn &txn,
+                                                const std::vector<std::string> &rooms);
         std::map<QString, RoomInfo> roomUpdates(const mtx::responses::Sync &sync)
         {
                 return getRoomInfo(roomsWithStateUpdates(sync));
@@ -198,42 +386,214 @@ public:
                                                      const std::string &query,
                                                      std::uint8_t max_items = 5);
 
+        //! Retrieve the latest saved timeline events of a room.
+        //!
+        //! The prev_batch token points before the oldest returned event,
+        //! so it can be used to paginate further back.
+        mtx::responses::Timeline getTimelineMessages(lmdb::txn &txn, const std::string &room_id);
+        //! Retrieve the saved timelines of all the joined rooms.
+        std::map<QString, mtx::responses::Timeline> roomMessages();
+
+        //! Search the text of the cached messages. An empty room id searches
+        //! all the joined rooms.
+        std::vector<MessageSearchResult> searchMessages(const QString &query,
+                                                        const QString &room_id = QString(),
+                                                        std::size_t limit = DEFAULT_SEARCH_LIMIT);
+
+        //! Retrieve the saved room list entries of all the joined rooms.
+        std::map<QString, RoomListEntry> roomListEntries();
+        //! Save the last message shown in the room list, keeping the unread count.
+        void saveLastMessage(const std::string &room_id, const RoomListEntry &message);
+        //! Save the unread count shown in the room list, keeping the last message.
+        void saveUnreadCount(const std::string &room_id, uint64_t count);
+
+        struct TableStatistics
+        {
+                std::string name;
+                //! Number of records.
+                uint64_t entries;
+                //! Height of the B-tree.
+                uint64_t depth;
+                //! Branch, leaf & overflow pages.
+                uint64_t pages;
+                //! Size of the pages in bytes.
+                uint64_t size;
+        };
+
+        struct Statistics
+        {
+                //! Size of the memory map in bytes.
+                uint64_t map_size;
+                uint64_t page_size;
+                //! Pages of the data file, including the free ones.
+                uint64_t used_pages;
+                //! Pages released by earlier transactions, waiting to be reused.
+                uint64_t free_pages;
+                std::vector<TableStatistics> tables;
+        };
+
+        //! Usage of the cache environment & each of its tables.
+        Statistics statistics();
+        //! Rewrite the data file without its free pages.
+        //!
+        //! The writes wait for the copy, the reads only for the file swap. Returns
+        //! false if the cache couldn't be compacted, in which case the old file is kept.
+        bool compact();
+        //! Compact the cache if the free pages take up a large part of it.
+        void compactIfNeeded();
+        //! Run a maintenance task, e.g the compaction or the garbage collection,
+        //! off the GUI thread. The tasks run one at a time & their lmdb errors are
+        //! logged. deleteData() waits for the running task & drops the queued ones.
+        void runMaintenance(std::function<void(Cache &)> task);
+
+        //! Write a compacted copy of the cache & a manifest with its format
+        //! version & sync token to the directory.
+        bool exportSnapshot(const QString &path);
+        //! Replace the cache of the user with an exported snapshot.
+        //!
+        //! Must be called before setup(). Snapshots of other users or of formats
+        //! that can't be migrated are rejected. The next start continues with
+        //! an incremental sync from the token of the snapshot.
+        bool importSnapshot(const QString &path);
+
+        //! Take a read-only snapshot of the cache.
+        //!
+        //! Lookups that need a consistent view, or several lookups in a row,
+        //! should share one snapshot instead of beginning a transaction each.
+        ReadSnapshot readSnapshot() const { return ReadSnapshot(readers_, env_, lockTxn()); }
+
+signals:
+        //! Emitted after each migration step.
+        void migrationProgress(int done, int total);
+        //! The members of the room were loaded, so their names & avatars can be shown.
+        void membersLoaded(const QString &room_id);
+
 private:
+        //! An upgrade of the cache layout from one format version to the next.
+        struct Migration
+        {
+                //! The format version the migration applies to.
+                std::string from;
+                //! The format version after the migration.
+                std::string to;
+                void (Cache::*run)(lmdb::txn &txn);
+        };
+
+        //! All the migrations, in the order they are applied.
+        static const std::vector<Migration> &migrations();
+        //! The migrations that lead from the given format to the current one.
+        //!
+        //! Empty if the format is current or there is no way to upgrade it.
+        static std::vector<const Migration *> migrationPath(const std::string &version);
+        std::string storedFormatVersion();
+
+        using TxnLock = std::shared_lock<std::shared_timed_mutex>;
+
+        //! Every transaction holds the lock in shared mode, so the map can only be
+        //! resized when there are no active transactions.
+        TxnLock lockTxn() const { return TxnLock(mapMutex_); }
+
+        //! Create & open the environment with the given map size.
+        void openEnvironment(const QString &path, std::size_t map_size);
+        //! The directory that holds the cache of the user.
+        QString cacheDirectory() const;
+        //! Flush the unsynced commits of the batched mode to disk.
+        void syncEnvironment();
+        //! Open the handles of the cache databases.
+        void openDatabases(lmdb::txn &txn);
+        //! Copy the environment without its free pages & swap it in. Runs on the writer thread.
+        bool compactEnvironment();
+        //! Wait for the running maintenance task & drop the queued ones.
+        void stopMaintenance();
+
+        //! Double the size of the memory map, up to the configured maximum.
+        //!
+        //! Returns false if the map can't grow any further.
+        bool growMap(std::size_t failed_size);
+
+        //! Run the write transaction again with a larger map, when it fails
+        //! because the map is full.
+        template<class Fn>
+        void retryOnMapFull(Fn &&fn)
+        {
+                while (true) {
+                        const std::size_t size = mapSize_;
+
+                        try {
+                                fn();
+                                return;
+                        } catch (const lmdb::map_full_error &e) {
+                                qWarning() << "cache map is full:" << e.what();
+
+                                if (!growMap(size))
+                                        throw;
+                        }
+                }
+        }
+
+        void saveState(lmdb::txn &txn, const mtx::responses::Sync &res);
+
+        //! Convert the room & member info from JSON to the binary format.
+        void migrateToBinaryRecords(lmdb::txn &txn);
+        //! Convert the read receipts from the JSON format to the composite keys.
+        void migrateReadReceipts(lmdb::txn &txn);
+
+        //! Append the message events of the timeline to the room's event store.
+        void saveTimelineMessages(lmdb::txn &txn,
+                                  const std::string &room_id,
+                                  const mtx::responses::Timeline &timeline);
+
         //! Save an invited room.
         void saveInvite(lmdb::txn &txn,
-                        lmdb::dbi &statesdb,
-                        lmdb::dbi &membersdb,
+                        const std::string &room_id,
                         const mtx::responses::InvitedRoom &room);
 
-        QString getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
-        QString getInviteRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb);
-        QString getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb);
+        QString getInviteRoomName(lmdb::txn &txn, const std::string &room_id);
+        QString getInviteRoomTopic(lmdb::txn &txn, const std::string &room_id);
+        QString getInviteRoomAvatarUrl(lmdb::txn &txn, const std::string &room_id);
+
+        //! Copy the entries of the per room databases to the shared tables.
+        void migrateToSharedTables(lmdb::txn &txn);
+        //! Index the text of the saved messages.
+        void migrateToSearchIndex(lmdb::txn &txn);
+
+        //! Retrieve the saved summary of the room.
+        //!
+        //! Rooms without a summary (e.g saved by an older version) get one
+        //! calculated from the stored members.
+        RoomSummary getRoomSummary(lmdb::txn &txn, const std::string &room_id);
+        //! Apply the member changes of a sync to the room's summary and
+        //! recalculate the room info.
+        void updateRoomInfo(lmdb::txn &txn, const std::string &room_id, int64_t members_delta);
+        //! Apply the update to the room list entry of a joined room on the writer thread.
+        void updateRoomListEntry(const std::string &room_id,
+                                 std::function<void(RoomListEntry &)> update);
 
         //! Remove a room from the cache.
         // void removeLeftRoom(lmdb::txn &txn, const std::string &room_id);
+        //! Save the state events & return the change in the number of members.
         template<class T>
-        void saveStateEvents(lmdb::txn &txn,
-                             const lmdb::dbi &statesdb,
-                             const lmdb::dbi &membersdb,
-                             const std::string &room_id,
-                             const std::vector<T> &events)
+        int64_t saveStateEvents(lmdb::txn &txn,
+                                const std::string &room_id,
+                                const std::vector<T> &events)
         {
+                int64_t members_delta = 0;
+
                 for (const auto &e : events)
-                        saveStateEvent(txn, statesdb, membersdb, room_id, e);
+                        members_delta += saveStateEvent(txn, room_id, e);
+
+                return members_delta;
         }
 
         template<class T>
-        void saveStateEvent(lmdb::txn &txn,
-                            const lmdb::dbi &statesdb,
-                            const lmdb::dbi &membersdb,
-                            const std::string &room_id,
-                            const T &event)
+        int64_t saveStateEvent(lmdb::txn &txn, const std::string &room_id, const T &event)
         {
                 using namespace mtx::events;
                 using namespace mtx::events::state;
 
                 if (mpark::holds_alternative<StateEvent<Member>>(event)) {
-                        const auto e = mpark::get<StateEvent<Member>>(event);
+                        const auto e   = mpark::get<StateEvent<Member>>(event);
+                        const auto key = memberKey(room_id, e.state_key);
 
                         switch (e.content.membership) {
                         //
@@ -248,46 +608,47 @@ private:
                                 // Lightweight representation of a member.
                                 MemberInfo tmp{display_name, e.content.avatar_url};
 
-                                lmdb::dbi_put(txn,
-                                              membersdb,
-                                              lmdb::val(e.state_key),
-                                              lmdb::val(json(tmp).dump()));
+                                lmdb::val unused;
+                                const bool isNew =
+                                  !lmdb::dbi_get(txn, roomMembersDb_, lmdb::val(key), unused);
 
-                                insertDisplayName(QString::fromStdString(room_id),
-                                                  QString::fromStdString(e.state_key),
-                                                  QString::fromStdString(display_name));
+                                lmdb::dbi_put(txn,
+                                              roomMembersDb_,
+                                              lmdb::val(key),
+                                              lmdb::val(record::encode(tmp)));
 
-                                insertAvatarUrl(QString::fromStdString(room_id),
-                                                QString::fromStdString(e.state_key),
-                                                QString::fromStdString(e.content.avatar_url));
+                                Members.insert(QString::fromStdString(room_id),
+                                               QString::fromStdString(e.state_key),
+                                               QString::fromStdString(display_name),
+                                               QString::fromStdString(e.content.avatar_url));
 
-                                break;
+                                return isNew ? 1 : 0;
                         }
                         default: {
-                                lmdb::dbi_del(
-                                  txn, membersdb, lmdb::val(e.state_key), lmdb::val(""));
+                                const bool removed =
+                                  lmdb::dbi_del(txn, roomMembersDb_, lmdb::val(key), nullptr);
 
-                                removeDisplayName(QString::fromStdString(room_id),
-                                                  QString::fromStdString(e.state_key));
-                                removeAvatarUrl(QString::fromStdString(room_id),
-                                                QString::fromStdString(e.state_key));
+                                Members.remove(QString::fromStdString(room_id),
+                                               QString::fromStdString(e.state_key));
 
-                                break;
+                                return removed ? -1 : 0;
                         }
                         }
-
-                        return;
                 }
 
                 if (!isStateEvent(event))
-                        return;
+                        return 0;
 
                 mpark::visit(
-                  [&txn, &statesdb](auto e) {
+                  [this, &txn, &room_id](auto e) {
+                          const auto key = stateKey(room_id, to_string(e.type), e.state_key);
+
                           lmdb::dbi_put(
-                            txn, statesdb, lmdb::val(to_string(e.type)), lmdb::val(json(e).dump()));
+                            txn, roomStateDb_, lmdb::val(key), lmdb::val(json(e).dump()));
                   },
                   event);
+
+                return 0;
         }
 
         template<class T>
@@ -321,6 +682,22 @@ private:
                        mpark::holds_alternative<StateEvent<Topic>>(e);
         }
 
+        //! Whether or not the event can be rendered in the timeline.
+        template<class T>
+        bool isTimelineMessage(const T &e)
+        {
+                using namespace mtx::events;
+
+                return mpark::holds_alternative<RedactionEvent<msg::Redaction>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::Audio>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::Emote>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::File>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::Image>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::Notice>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::Text>>(e) ||
+                       mpark::holds_alternative<RoomEvent<msg::Video>>(e);
+        }
+
         bool containsStateUpdates(const mtx::events::collections::StrippedEvents &e)
         {
                 using namespace mtx::events;
@@ -333,6 +710,14 @@ private:
                        mpark::holds_alternative<StrippedEvent<Topic>>(e);
         }
 
+        template<class T>
+        bool hasStateUpdates(const std::vector<T> &events)
+        {
+                return std::any_of(events.begin(), events.end(), [this](const T &e) {
+                        return containsStateUpdates(e);
+                });
+        }
+
         void saveInvites(lmdb::txn &txn,
                          const std::map<std::string, mtx::responses::InvitedRoom> &rooms);
 
@@ -348,26 +733,18 @@ private:
                 }
         }
 
-        lmdb::dbi getInviteStatesDb(lmdb::txn &txn, const std::string &room_id)
-        {
-                return lmdb::dbi::open(
-                  txn, std::string(room_id + "/invite_state").c_str(), MDB_CREATE);
-        }
-
-        lmdb::dbi getInviteMembersDb(lmdb::txn &txn, const std::string &room_id)
+        //! Key of a state event in the shared state tables.
+        static std::string stateKey(const std::string &room_id,
+                                    const std::string &type,
+                                    const std::string &state_key)
         {
-                return lmdb::dbi::open(
-                  txn, std::string(room_id + "/invite_members").c_str(), MDB_CREATE);
+                return room_id + '\0' + type + '\0' + state_key;
         }
 
-        lmdb::dbi getStatesDb(lmdb::txn &txn, const std::string &room_id)
+        //! Key of a member in the shared member tables.
+        static std::string memberKey(const std::string &room_id, const std::string &user_id)
         {
-                return lmdb::dbi::open(txn, std::string(room_id + "/state").c_str(), MDB_CREATE);
-        }
-
-        lmdb::dbi getMembersDb(lmdb::txn &txn, const std::string &room_id)
-        {
-                return lmdb::dbi::open(txn, std::string(room_id + "/members").c_str(), MDB_CREATE);
+                return room_id + '\0' + user_id;
         }
 
         QString getDisplayName(const mtx::events::StateEvent<mtx::events::state::Member> &event)
@@ -382,11 +759,43 @@ private:
         void setNextBatchToken(lmdb::txn &txn, const QString &token);
 
         lmdb::env env_;
+        mutable std::shared_timed_mutex mapMutex_;
+        //! Reset read-only transactions ready for the next lookup.
+        mutable ReadTxnPool readers_;
+        std::atomic<std::size_t> mapSize_;
+        std::size_t maxMapSize_;
+        Durability durability_;
+        //! Syncs the environment in the batched mode.
+        QTimer *syncTimer_;
+
         lmdb::dbi syncStateDb_;
         lmdb::dbi roomsDb_;
         lmdb::dbi invitesDb_;
-        lmdb::dbi mediaDb_;
+        lmdb::dbi roomStateDb_;
+        lmdb::dbi roomMembersDb_;
+        lmdb::dbi inviteStateDb_;
+        lmdb::dbi inviteMembersDb_;
+        lmdb::dbi roomMessagesDb_;
+        lmdb::dbi roomSummariesDb_;
+        lmdb::dbi roomListDb_;
         lmdb::dbi readReceiptsDb_;
+        lmdb::dbi latestReceiptsDb_;
+
+        //! Full-text index of the messages.
+        SearchIndex search_;
+
+        //! In-memory copy of roomsDb_ & invitesDb_.
+        RoomInfoTable roomTable_;
+
+        QSharedPointer<MediaCache> media_;
+        //! Saves the media one at a time, apart from the state writes.
+        QThreadPool mediaWriter_;
+        //! Runs the maintenance tasks one at a time.
+        QThreadPool maintenance_;
+        //! Set while the maintenance is stopped, so the tasks give up early.
+        std::atomic<bool> maintenanceStopped_{false};
+        //! Commits the writes on a dedicated thread.
+        QSharedPointer<CacheWriter> writer_;
 
         QString localUserId_;
         QString cacheDirectory_;
@@ -0,0 +1,85 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <lmdb++.h>
+
+//! Runs the cache writes on a dedicated thread.
+//!
+//! The queued writes are committed in batches, so many small writes share a
+//! single transaction instead of each waiting for the LMDB writer lock. The
+//! callers that need to know when their data is durable can wait on the
+//! returned future or on a fence.
+class CacheWriter
+{
+public:
+        //! A write that is applied in the transaction of its batch.
+        using Write = std::function<void(lmdb::txn &txn)>;
+        //! Opens a write transaction, applies the batch & commits it.
+        using Runner = std::function<void(const Write &batch)>;
+
+        CacheWriter(Runner runner);
+        //! Commits the queued writes & stops the writer thread.
+        ~CacheWriter();
+
+        //! Queue a write. The callback is invoked on the writer thread after
+        //! the write is committed.
+        std::shared_future<void> enqueue(Write write, std::function<void()> onCommit = nullptr);
+        //! Queue a task that runs on the writer thread outside of a batch.
+        //!
+        //! Used for the writes to other environments, so they don't contend
+        //! with the cache writes.
+        std::shared_future<void> post(std::function<void()> task);
+        //! Resolves when everything queued before it is committed.
+        std::shared_future<void> fence();
+        //! Block until everything queued so far is committed.
+        void flush() { fence().wait(); }
+
+private:
+        struct Entry
+        {
+                Write write;
+                std::function<void()> task;
+                std::function<void()> onCommit;
+                std::promise<void> done;
+        };
+
+        std::shared_future<void> push(std::unique_ptr<Entry> entry);
+
+        void run();
+        //! Commit the writes in one transaction, falling back to a transaction
+        //! per write if the batch fails, so one bad write doesn't drop the rest.
+        void commit(std::vector<std::unique_ptr<Entry>> &batch);
+
+        Runner runner_;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::unique_ptr<Entry>> queue_;
+        bool stopping_ = false;
+
+        std::thread thread_;
+};
@@ -17,10 +17,13 @@
 
 #pragma once
 
+#include <atomic>
+
 #include <QFrame>
 #include <QHBoxLayout>
 #include <QMap>
 #include <QPixmap>
+#include <QThreadPool>
 #include <QTimer>
 #include <QWidget>
 
@@ -44,15 +47,22 @@ class UserInfoWidget;
 class UserSettings;
 
 namespace dialogs {
+class MessageSearch;
 class ReadReceipts;
 }
 
 constexpr int CONSENSUS_TIMEOUT      = 1000;
 constexpr int SHOW_CONTENT_TIMEOUT   = 3000;
 constexpr int TYPING_REFRESH_TIMEOUT = 10000;
+//! Delay of the cache garbage collection after startup.
+constexpr int CACHE_GC_DELAY = 30000;
+//! Maximum number of sync responses received but not yet saved & applied.
+//! The next sync waits while the limit is reached.
+constexpr int MAX_PENDING_SYNCS = 2;
 
 Q_DECLARE_METATYPE(mtx::responses::Rooms)
 Q_DECLARE_METATYPE(std::vector<std::string>)
+Q_DECLARE_METATYPE(std::vector<MessageSearchResult>)
 
 class ChatPage : public QWidget
 {
@@ -66,6 +76,7 @@ public:
         // Initialize all the components of the UI.
         void bootstrap(QString userid, QString homeserver, QString token);
         void showQuickSwitcher();
+        void showMessageSearch();
         void showReadReceipts(const QString &event_id);
         QString currentRoom() const { return current_room_; }
 
@@ -80,6 +91,10 @@ public:
         }
 
         QSharedPointer<UserSettings> userSettings() { return userSettings_; }
+        //! Reclaim the free space of the cache in the background.
+        void compactCache();
+        //! Write the pending cache changes to disk.
+        void flushCache();
 
 signals:
         void contentLoaded();
@@ -94,10 +109,18 @@ signals:
 
         void initializeRoomList(QMap<QString, RoomInfo>);
         void initializeViews(const mtx::responses::Rooms &rooms);
-        void initializeEmptyViews(const std::vector<std::string> &rooms);
+        void initializeCachedViews(const std::map<QString, mtx::responses::Timeline> &msgs);
         void syncUI(const mtx::responses::Rooms &rooms);
         void continueSync(const QString &next_batch);
         void syncRoomlist(const std::map<QString, RoomInfo> &updates);
+        void cacheMigrated();
+        //! A sync response was saved & applied.
+        void syncProcessed();
+        //! A sync response couldn't be saved.
+        void syncSaveFailed();
+        //! The results of a message search made in the background.
+        void messageSearchFinished(const QString &query,
+                                   const std::vector<MessageSearchResult> &results);
 
 private slots:
         void showUnreadMessageNotification(int count);
@@ -124,6 +147,8 @@ private:
 
         void updateTypingUsers(const QString &roomid, const std::vector<std::string> &user_ids);
 
+        //! Load the cache once its format is up to date.
+        void loadCache();
         void loadStateFromCache();
         void deleteConfigs();
         void resetUI();
@@ -182,6 +207,9 @@ private:
         QSharedPointer<QuickSwitcher> quickSwitcher_;
         QSharedPointer<OverlayModal> quickSwitcherModal_;
 
+        QSharedPointer<dialogs::MessageSearch> messageSearch_;
+        QSharedPointer<OverlayModal> messageSearchModal_;
+
         QSharedPointer<dialogs::ReadReceipts> receiptsDialog_;
         QSharedPointer<OverlayModal> receiptsModal_;
 
@@ -193,6 +221,17 @@ private:
 
         // LMDB wrapper.
         QSharedPointer<Cache> cache_;
+
+        //! Saves & applies the sync responses one at a time, in order.
+        QThreadPool syncPipeline_;
+        //! Number of sync responses in the pipeline.
+        int pendingSyncs_ = 0;
+        //! The token of the sync that waits for the pipeline.
+        QString pausedBatchToken_;
+        //! Set on logout. The queued responses are dropped.
+        std::atomic<bool> syncStopped_{false};
+        //! Set when a response couldn't be saved, until the sync restarts from the cache.
+        std::atomic<bool> syncFailed_{false};
 };
 
 template<class Collection>
@@ -0,0 +1,64 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include <lmdb++.h>
+
+//! Integers in keys are stored in big-endian, so the lexicographic order
+//! of LMDB matches their numeric order.
+inline void
+appendKeyUint64BE(std::string &buf, uint64_t value)
+{
+        for (std::size_t i = 0; i < sizeof(value); ++i)
+                buf.push_back(static_cast<char>((value >> (8 * (sizeof(value) - i - 1))) & 0xff));
+}
+
+inline std::string
+encodeKeyUint64BE(uint64_t value)
+{
+        std::string buf;
+        buf.reserve(sizeof(value));
+
+        appendKeyUint64BE(buf, value);
+
+        return buf;
+}
+
+inline uint64_t
+decodeKeyUint64BE(const char *data, std::size_t size)
+{
+        uint64_t value = 0;
+
+        for (std::size_t i = 0; i < size && i < sizeof(value); ++i)
+                value = (value << 8) | static_cast<uint8_t>(data[i]);
+
+        return value;
+}
+
+//! Whether or not the key starts with the given prefix.
+inline bool
+hasPrefix(const lmdb::val &key, const std::string &prefix)
+{
+        return key.size() >= prefix.size() &&
+               std::equal(prefix.begin(), prefix.end(), key.data());
+}
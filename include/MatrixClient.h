@@ -19,9 +19,13 @@
 
 #include <QFileInfo>
 #include <QNetworkAccessManager>
+#include <QPointer>
 #include <QUrl>
 #include <mtx.hpp>
 
+#include "RequestScheduler.h"
+#include "ResponseDecoder.h"
+
 class DownloadMediaProxy : public QObject
 {
         Q_OBJECT
@@ -42,6 +46,24 @@ class MatrixClient : public QNetworkAccessManager
 {
         Q_OBJECT
 public:
+        struct TransferStatistics
+        {
+                //! Number of requests finished.
+                uint64_t requests;
+                //! Number of the finished requests that used HTTP/2.
+                uint64_t http2_requests;
+                //! Size of the responses on the wire, before they are decompressed.
+                uint64_t wire_bytes;
+                //! Size of the same responses, decoded.
+                uint64_t decoded_bytes;
+                //! Number of the compressed responses sent without a length. Qt
+                //! only reports their decoded size, so their size on the wire is
+                //! unknown & they are left out of the two sizes above.
+                uint64_t unmeasured_requests;
+                //! Size of the decoded responses with an unknown size on the wire.
+                uint64_t unmeasured_bytes;
+        };
+
         MatrixClient(QString server, QObject *parent = 0);
 
         // Client API.
@@ -61,13 +83,16 @@ public:
                           const QString &session = "") noexcept;
         void versions() noexcept;
         void fetchRoomAvatar(const QString &roomid, const QUrl &avatar_url);
-        //! Download user's avatar.
-        QSharedPointer<DownloadMediaProxy> fetchUserAvatar(const QUrl &avatarUrl);
+        //! Download user's avatar. The room, if any, is the one it's shown in.
+        QSharedPointer<DownloadMediaProxy> fetchUserAvatar(const QUrl &avatarUrl,
+                                                           const QString &room_id = QString());
         void fetchCommunityAvatar(const QString &communityId, const QUrl &avatarUrl);
         void fetchCommunityProfile(const QString &communityId);
         void fetchCommunityRooms(const QString &communityId);
-        QSharedPointer<DownloadMediaProxy> downloadImage(const QUrl &url);
-        QSharedPointer<DownloadMediaProxy> downloadFile(const QUrl &url);
+        QSharedPointer<DownloadMediaProxy> downloadImage(const QUrl &url,
+                                                         const QString &room_id = QString());
+        QSharedPointer<DownloadMediaProxy> downloadFile(const QUrl &url,
+                                                        const QString &room_id = QString());
         void messages(const QString &room_id, const QString &from_token, int limit = 30) noexcept;
         void uploadImage(const QString &roomid,
                          const QString &filename,
@@ -96,6 +121,18 @@ public:
         int incrementTransactionId() { return ++txn_id_; };
 
         void reset() noexcept;
+        //! Abort the running sync. Its response is dropped, even if it's already being decoded.
+        void abortSync();
+
+        //! The room shown to the user. Its requests are started first.
+        void setVisibleRoom(const QString &room_id) { scheduler_->setVisibleRoom(room_id); }
+        //! The queue depth & the running requests of each priority class.
+        std::array<RequestScheduler::Statistics, REQUEST_PRIORITIES> requestStatistics() const
+        {
+                return scheduler_->statistics();
+        }
+        //! The protocol & the sizes of the transfers since the client was created.
+        TransferStatistics transferStatistics() const { return transfers_; }
 
 public slots:
         void getOwnProfile() noexcept;
@@ -176,7 +213,17 @@ signals:
         void redactionFailed(const QString &error);
         void redactionCompleted(const QString &room_id, const QString &event_id);
 
+protected:
+        //! Allow HTTP/2 for the homeserver requests, ask for compression only
+        //! where it helps & count the transfer of each request.
+        QNetworkReply *createRequest(Operation op,
+                                     const QNetworkRequest &request,
+                                     QIODevice *outgoingData = nullptr) override;
+
 private:
+        //! Add the protocol & the sizes of the transfer to the statistics when the reply finishes.
+        void recordTransfer(QNetworkReply *reply);
+
         QNetworkReply *makeUploadRequest(QSharedPointer<QIODevice> iodev);
         QJsonObject getUploadReply(QNetworkReply *reply);
 
@@ -201,4 +248,14 @@ private:
         QString serverProtocol_;
         //! Filter to be send as filter-param for (initial) /sync requests.
         QString filter_;
+        //! Decodes the responses off the GUI thread.
+        ResponseDecoder *responseDecoder_;
+        //! Starts the requests by priority.
+        RequestScheduler *scheduler_;
+        //! The last sync request that was started.
+        QPointer<QNetworkReply> syncReply_;
+        //! Incremented by abortSync(), so the responses of the older syncs are dropped.
+        uint64_t syncGeneration_ = 0;
+        //! Totals of the finished transfers.
+        TransferStatistics transfers_{};
 };
@@ -0,0 +1,108 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include <QByteArray>
+#include <QFuture>
+#include <QString>
+#include <lmdb++.h>
+
+#include "ReadTxnPool.h"
+
+//! Default size limit of the downloaded media.
+constexpr uint64_t DEFAULT_MEDIA_SIZE_LIMIT = 128UL * 1024UL * 1024UL; /* 128 MB */
+
+//! Keeps already downloaded media for reuse.
+//!
+//! The media are kept in their own LMDB environment, so they can't take up
+//! the space needed by the room state. When the total size exceeds the
+//! configured limit, the least recently used entries are evicted in the
+//! background.
+class MediaCache
+{
+public:
+        struct Statistics
+        {
+                //! Number of lookups that found the media.
+                uint64_t hits;
+                //! Number of lookups that didn't find the media.
+                uint64_t misses;
+                //! Number of entries removed to stay under the size limit.
+                uint64_t evictions;
+                //! Total size of the saved media in bytes.
+                uint64_t size;
+                //! The configured size limit in bytes.
+                uint64_t limit;
+        };
+
+        MediaCache(const QString &path, uint64_t limit = DEFAULT_MEDIA_SIZE_LIMIT);
+        ~MediaCache();
+
+        void setup();
+
+        QByteArray image(const QString &url);
+        void saveImage(const QString &url, const QByteArray &data);
+
+        Statistics statistics() const;
+
+private:
+        //! Remove the least recently used entries until the cache
+        //! size drops below the limit.
+        void evict();
+        //! Run the eviction in a worker thread if the limit is exceeded.
+        void scheduleEviction();
+        //! Persist the access times recorded by the lookups. They stay pending
+        //! until the transaction is committed, so a failed one is retried.
+        std::map<std::string, uint64_t> flushAccessTimes(lmdb::txn &txn);
+        //! Forget the access times written by a committed transaction.
+        void clearAccessTimes(const std::map<std::string, uint64_t> &flushed);
+        void put(const std::string &url, const QByteArray &data);
+
+        QString path_;
+
+        lmdb::env env_;
+        //! Reset read-only transactions for the lookups.
+        ReadTxnPool readers_;
+        //! Format: url -> binary data.
+        lmdb::dbi dataDb_;
+        //! Format: url -> size, access time.
+        lmdb::dbi metaDb_;
+        //! Format: access time, url -> empty.
+        lmdb::dbi lruDb_;
+
+        const uint64_t limit_;
+        std::atomic<uint64_t> size_;
+
+        std::atomic<uint64_t> hits_;
+        std::atomic<uint64_t> misses_;
+        std::atomic<uint64_t> evictions_;
+
+        std::atomic<bool> isEvicting_;
+        QFuture<void> eviction_;
+
+        //! Access times that are not yet saved.
+        //!
+        //! The lookups are served from read-only transactions, so the access
+        //! times are written along with the next save or eviction.
+        std::mutex accessMutex_;
+        std::map<std::string, uint64_t> pendingAccess_;
+};
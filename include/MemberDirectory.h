@@ -0,0 +1,158 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+//! Default number of members kept in memory.
+constexpr std::size_t DEFAULT_MEMBER_LIMIT = 50000;
+//! The interned strings aren't released while there are fewer than this.
+constexpr std::size_t MIN_STRINGS = 4096;
+
+//! Display names & avatars of the room members, shared by all the threads.
+//!
+//! Readers work on an immutable snapshot, so lookups never block and don't
+//! allocate. Writers stage their changes and publish them all at once with
+//! commit(), which copies only the rooms that changed. The ids, names and
+//! urls of the loaded rooms are interned, so users that appear in many rooms
+//! share the same string data.
+//!
+//! The members of a room are loaded from the cache on demand and the least
+//! recently used rooms are dropped when the total number of loaded members
+//! exceeds the limit. A lookup in a room that isn't loaded misses & queues the
+//! load on a worker thread, so it never reads the cache. Once the room is
+//! published, the lookups, including those of unknown members, are served
+//! from memory and the loaded handler is called to refresh the names.
+class MemberDirectory
+{
+public:
+        struct Member
+        {
+                QString display_name;
+                QString avatar_url;
+        };
+
+        using Members = QHash<QString, Member>;
+
+        //! Retrieve all the members of a room. Returns false if they couldn't be read.
+        using RoomLoader = std::function<bool(const QString &room_id, Members &members)>;
+        //! Called from the worker thread once the members of a room are published.
+        using LoadedHandler = std::function<void(const QString &room_id)>;
+
+        MemberDirectory();
+
+        //! The display name of the member or the user id if it's unknown.
+        QString displayName(const QString &room_id, const QString &user_id);
+        //! The avatar url of the member or an empty string if it's unknown.
+        QString avatarUrl(const QString &room_id, const QString &user_id);
+
+        //! Add or update a member. The change is visible after commit().
+        void insert(const QString &room_id,
+                    const QString &user_id,
+                    const QString &display_name,
+                    const QString &avatar_url);
+        //! Remove a member. The change is visible after commit().
+        void remove(const QString &room_id, const QString &user_id);
+
+        //! Publish the staged changes to the readers.
+        //!
+        //! Changes to rooms that aren't loaded are dropped, since they will be
+        //! read from the cache when the room is loaded.
+        void commit();
+        //! Drop the staged changes, e.g when their transaction failed.
+        void discard();
+        //! Remove all the members.
+        void clear();
+
+        //! Set how the members are read from the cache & who is told of the loaded rooms.
+        void setLoader(RoomLoader roomLoader, LoadedHandler onLoaded = nullptr);
+        //! Maximum number of members kept in memory.
+        void setLimit(std::size_t limit);
+        //! Load the members of the rooms in a worker thread.
+        void prefetch(const std::vector<QString> &room_ids);
+
+private:
+        struct Room
+        {
+                Room(const Members &members = Members())
+                  : members{members}
+                  , lastUsed{0}
+                {}
+
+                Members members;
+                mutable std::atomic<uint64_t> lastUsed;
+        };
+
+        struct Snapshot
+        {
+                QHash<QString, std::shared_ptr<const Room>> rooms;
+        };
+
+        //! A staged insertion or removal of a member.
+        struct Change
+        {
+                bool removed = false;
+                Member member;
+        };
+
+        std::shared_ptr<const Snapshot> snapshot() const { return std::atomic_load(&snapshot_); }
+        bool find(const QString &room_id, const QString &user_id, Member &member);
+
+        //! Load the room on the global thread pool, unless it's already being loaded.
+        void requestLoad(const QString &room_id);
+        //! Load all the members of the room, if it isn't loaded yet.
+        void load(const QString &room_id);
+        //! Drop the least recently used rooms until the limit is respected.
+        //! Returns true if any room was dropped. Requires the write lock.
+        bool evict(Snapshot &snapshot, const QString &keep);
+        //! Keep only the strings used by the snapshot. Requires the write lock.
+        void releaseStrings(const Snapshot &snapshot);
+
+        //! Return the shared copy of the string. Requires the write lock.
+        QString intern(const QString &str);
+
+        std::shared_ptr<const Snapshot> snapshot_;
+        mutable std::atomic<uint64_t> clock_;
+
+        std::mutex writeMutex_;
+        QHash<QString, QHash<QString, Change>> pending_;
+        QSet<QString> strings_;
+        //! Rooms queued by requestLoad().
+        QSet<QString> loading_;
+        //! Number of strings in use after the last release. The strings of the
+        //! replaced names are released when the pool grows to twice as much.
+        std::size_t liveStrings_ = 0;
+        std::size_t loadedMembers_ = 0;
+        //! Number of commits. Tells the loads that changes were published
+        //! while they read from the cache.
+        uint64_t commits_ = 0;
+        std::size_t limit_         = DEFAULT_MEMBER_LIMIT;
+
+        mutable std::shared_timed_mutex loaderMutex_;
+        RoomLoader roomLoader_;
+        LoadedHandler onLoaded_;
+};
@@ -0,0 +1,74 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include <lmdb++.h>
+
+//! Keeps reset read-only transactions around for reuse.
+//!
+//! Beginning a transaction takes a reader slot & allocates the transaction,
+//! while renewing a reset one only takes a new snapshot of the database.
+//! The environment must be opened with MDB_NOTLS, so the transactions can be
+//! renewed on any thread.
+class ReadTxnPool
+{
+public:
+        ReadTxnPool(std::size_t capacity = 4);
+
+        //! Return a renewed or a new read-only transaction.
+        lmdb::txn acquire(MDB_env *env);
+        //! Reset the transaction & keep it for the next reader.
+        void release(lmdb::txn &&txn);
+        //! Abort the idle transactions, e.g before the map is resized.
+        void clear();
+
+private:
+        const std::size_t capacity_;
+
+        std::mutex mutex_;
+        std::vector<lmdb::txn> idle_;
+};
+
+//! A consistent read-only view of the database.
+//!
+//! Several reads can share the snapshot, so they need only one transaction.
+//! The transaction goes back to the pool when the snapshot is destroyed.
+class ReadSnapshot
+{
+public:
+        using Lock = std::shared_lock<std::shared_timed_mutex>;
+
+        ReadSnapshot(ReadTxnPool &pool, MDB_env *env, Lock lock = Lock());
+        ReadSnapshot(ReadSnapshot &&other) = default;
+        ~ReadSnapshot();
+
+        ReadSnapshot(const ReadSnapshot &) = delete;
+        ReadSnapshot &operator=(const ReadSnapshot &) = delete;
+
+        lmdb::txn &txn() { return txn_; }
+
+private:
+        // The lock must outlive the transaction.
+        Lock lock_;
+        ReadTxnPool *pool_;
+        lmdb::txn txn_;
+};
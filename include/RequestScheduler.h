@@ -0,0 +1,112 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <deque>
+#include <functional>
+
+#include <QObject>
+#include <QString>
+
+class QNetworkReply;
+
+//! The classes of the scheduled requests, from the most urgent.
+enum class RequestPriority
+{
+        //! Requests made by the user: messages, read markers, typing, downloads.
+        Send,
+        Sync,
+        //! History of the visible room.
+        Pagination,
+        //! Media shown in the visible room or the room list.
+        Media,
+        //! Requests for rooms that aren't visible.
+        Prefetch,
+};
+
+constexpr int REQUEST_PRIORITIES = 5;
+
+//! Maximum number of running requests of each class.
+constexpr int MAX_SEND_REQUESTS       = 4;
+constexpr int MAX_SYNC_REQUESTS       = 2;
+constexpr int MAX_PAGINATION_REQUESTS = 2;
+constexpr int MAX_MEDIA_REQUESTS      = 4;
+constexpr int MAX_PREFETCH_REQUESTS   = 2;
+//! Maximum number of running pagination, media & prefetch requests. Qt opens
+//! up to six connections per host; the rest are left to the sync & the user.
+constexpr int MAX_BACKGROUND_REQUESTS = 4;
+
+//! Starts the requests to the homeserver by priority.
+//!
+//! Each class has its own queue & its own limit of running requests. The
+//! pagination & the media of rooms that aren't visible are queued as
+//! prefetch, and they move back when the room becomes visible.
+class RequestScheduler : public QObject
+{
+        Q_OBJECT
+
+public:
+        struct Statistics
+        {
+                //! Number of requests waiting to start.
+                int queued;
+                //! Number of requests started & not yet finished.
+                int active;
+                //! Number of requests finished.
+                uint64_t finished;
+        };
+
+        //! Starts a request & returns its reply. The reply is owned by the caller.
+        using Request = std::function<QNetworkReply *()>;
+
+        explicit RequestScheduler(QObject *parent = nullptr);
+
+        //! Queue a request. The room, if any, decides whether the
+        //! pagination & the media requests are prefetch.
+        void enqueue(RequestPriority priority, const QString &room_id, Request start);
+        //! Move the queued requests of the room in front.
+        void setVisibleRoom(const QString &room_id);
+        //! Drop the queued requests & free the slots of the running ones.
+        void clear();
+
+        int queueDepth(RequestPriority priority) const;
+        std::array<Statistics, REQUEST_PRIORITIES> statistics() const;
+
+private:
+        struct Job
+        {
+                //! The class requested by the caller.
+                RequestPriority priority;
+                QString room_id;
+                Request start;
+        };
+
+        //! The class of the job given the visible room.
+        RequestPriority effectivePriority(const Job &job) const;
+        //! Start the queued requests while the limits allow.
+        void pump();
+
+        QString visibleRoom_;
+
+        std::array<std::deque<Job>, REQUEST_PRIORITIES> queues_;
+        std::array<int, REQUEST_PRIORITIES> active_{};
+        std::array<uint64_t, REQUEST_PRIORITIES> finished_{};
+        //! Incremented by clear(), so the requests started before it don't free a slot.
+        uint64_t generation_ = 0;
+};
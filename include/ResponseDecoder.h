@@ -0,0 +1,98 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+
+//! Number of threads decoding the responses.
+constexpr int DECODER_THREADS = 2;
+
+//! Decodes the network responses off the GUI thread.
+//!
+//! The decoding runs on a bounded thread pool and the results are handled
+//! back on the thread that owns the decoder. The responses of the same queue
+//! are handled in the order they were submitted, even if a later one is
+//! decoded first.
+class ResponseDecoder : public QObject
+{
+        Q_OBJECT
+
+public:
+        explicit ResponseDecoder(QObject *parent = nullptr);
+        ~ResponseDecoder();
+
+        //! Decode a response on the pool & pass the result to the handler. If
+        //! the decoding throws, the error handler receives the message instead.
+        template<class Result>
+        void run(const QString &queue,
+                 std::function<Result()> decode,
+                 std::function<void(Result &)> onResult,
+                 std::function<void(const QString &)> onError = nullptr);
+
+signals:
+        //! A job was decoded. Emitted from the pool.
+        void decoded();
+
+private slots:
+        //! Handle the decoded jobs at the front of the queues.
+        void deliver();
+
+private:
+        struct Job
+        {
+                //! Handles the result on the owner's thread.
+                std::function<void()> handle;
+                std::atomic<bool> done{false};
+        };
+
+        void submit(const QString &queue, std::shared_ptr<Job> job, std::function<void()> decode);
+
+        QThreadPool pool_;
+        std::map<QString, std::deque<std::shared_ptr<Job>>> queues_;
+};
+
+template<class Result>
+void
+ResponseDecoder::run(const QString &queue,
+                     std::function<Result()> decode,
+                     std::function<void(Result &)> onResult,
+                     std::function<void(const QString &)> onError)
+{
+        auto job = std::make_shared<Job>();
+
+        submit(queue, job, [job, decode, onResult, onError]() {
+                try {
+                        auto result = std::make_shared<Result>(decode());
+                        job->handle = [result, onResult]() { onResult(*result); };
+                } catch (const std::exception &e) {
+                        const auto error = QString::fromUtf8(e.what());
+                        job->handle      = [error, onError]() {
+                                if (onError)
+                                        onError(error);
+                        };
+                }
+        });
+}
@@ -20,6 +20,7 @@
 #include <QPushButton>
 #include <QScrollArea>
 #include <QSharedPointer>
+#include <QTimer>
 #include <QVBoxLayout>
 #include <QWidget>
 
@@ -78,11 +79,15 @@ protected:
 
 private slots:
         void sortRoomsByLastMessage();
+        //! Load the members of the rooms shown in the list in the background.
+        void prefetchVisibleRooms();
 
 private:
         //! Return the first non-null room.
         std::pair<QString, QSharedPointer<RoomInfoListItem>> firstRoom() const;
         void calculateUnreadMessageCount();
+        //! Show the last messages & unread counts saved by the previous session.
+        void restoreEntries(const std::map<QString, RoomListEntry> &entries);
         bool roomExists(const QString &room_id) { return rooms_.find(room_id) != rooms_.end(); }
         bool filterItemExists(const QString &id)
         {
@@ -96,6 +101,9 @@ private:
 
         QPushButton *joinRoomButton_;
 
+        //! Delays the prefetching of the members while scrolling.
+        QTimer *prefetchTimer_;
+
         OverlayModal *joinRoomModal_;
 
         std::map<QString, QSharedPointer<RoomInfoListItem>> rooms_;
@@ -0,0 +1,90 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <QString>
+#include <json.hpp>
+#include <lmdb++.h>
+
+//! Default number of messages returned by a search.
+constexpr std::size_t DEFAULT_SEARCH_LIMIT = 50;
+
+//! A message that matched a search.
+struct MessageSearchResult
+{
+        QString room_id;
+        QString event_id;
+        QString sender;
+        //! Time of the message in milliseconds.
+        uint64_t timestamp;
+        //! The text of the message around the first match.
+        QString snippet;
+        double score;
+};
+
+//! Inverted index over the text of the cached messages.
+//!
+//! The messages are split into case folded terms and every term has a
+//! posting list per room, ordered by time, so a search can be limited to a
+//! room without reading the postings of the others, and reads the most
+//! recent messages of each room first. The indexed text is
+//! kept along with the index, since the cache keeps only the latest
+//! messages of the timelines.
+class SearchIndex
+{
+public:
+        SearchIndex();
+
+        void open(lmdb::txn &txn);
+        //! The names & handles of the databases, for the statistics.
+        std::vector<std::pair<const char *, MDB_dbi>> databases() const;
+
+        //! Index a timeline event. Redactions remove the redacted message.
+        void add(lmdb::txn &txn, const std::string &room_id, const nlohmann::json &event);
+        void remove(lmdb::txn &txn, const std::string &room_id, const std::string &event_id);
+        void removeRoom(lmdb::txn &txn, const std::string &room_id);
+
+        //! The messages that contain all the terms of the query, best first.
+        //! The last term also matches the words that start with it, since it
+        //! might not be fully typed. An empty room id searches all the rooms.
+        std::vector<MessageSearchResult> search(lmdb::txn &txn,
+                                                const QString &query,
+                                                const std::string &room_id,
+                                                std::size_t limit = DEFAULT_SEARCH_LIMIT);
+
+        //! Split the text into the terms that are indexed.
+        static std::vector<std::string> tokenize(const QString &text);
+
+private:
+        //! Add or remove the postings of a message.
+        void updatePostings(lmdb::txn &txn,
+                            const std::string &document,
+                            const QString &body,
+                            bool removed);
+
+        //! Format: room_id\0event_id -> timestamp, sender, body.
+        lmdb::dbi documentsDb_;
+        //! Format: term\0room_id\0timestamp event_id -> term frequency.
+        lmdb::dbi postingsDb_;
+        //! Format: term -> number of messages that contain it.
+        lmdb::dbi termsDb_;
+};
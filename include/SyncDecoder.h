@@ -0,0 +1,47 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <mtx/responses.hpp>
+
+//! Collects a /sync response while it's downloaded & converts it to the
+//! response structures.
+//!
+//! The received chunks are appended to a single buffer, sized from the
+//! Content-Length of the response, instead of being kept by the reply until
+//! it finishes. The buffer is released as soon as it's parsed and the rooms
+//! are converted one at a time, each dropping its JSON right after, so the
+//! peak memory is close to the larger of the JSON & the converted response
+//! instead of their sum.
+class SyncDecoder
+{
+public:
+        //! Reserve the space for the whole response, if its size is known.
+        void reserve(qint64 size);
+        void append(const QByteArray &chunk);
+
+        //! Number of bytes received so far.
+        int size() const { return data_.size(); }
+
+        //! Convert the received response. The decoder is empty afterwards.
+        mtx::responses::Sync decode();
+
+private:
+        QByteArray data_;
+};
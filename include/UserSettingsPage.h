@@ -115,6 +115,7 @@ protected:
 signals:
         void moveBack();
         void trayOptionChanged(bool value);
+        void compactCache();
 
 private:
         void restoreThemeCombo() const;
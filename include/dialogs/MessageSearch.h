@@ -0,0 +1,64 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <QFrame>
+#include <QListWidget>
+#include <QMap>
+#include <QTimer>
+
+#include "Cache.h"
+
+class TextField;
+
+namespace dialogs {
+
+class MessageSearch : public QFrame
+{
+        Q_OBJECT
+public:
+        explicit MessageSearch(QWidget *parent = nullptr);
+
+        //! The query that is currently typed.
+        QString query() const;
+        //! Show the results of the latest query. The room info provides
+        //! the names of the rooms.
+        void setResults(const std::vector<MessageSearchResult> &results,
+                        const QMap<QString, RoomInfo> &rooms);
+
+signals:
+        //! The query was edited & the user stopped typing.
+        void queryChanged(const QString &query);
+        void resultSelected(const QString &room_id, const QString &event_id);
+        void closing();
+
+protected:
+        void paintEvent(QPaintEvent *event) override;
+        void showEvent(QShowEvent *event) override;
+        void keyPressEvent(QKeyEvent *event) override;
+
+private:
+        TextField *queryInput_;
+        QListWidget *resultList_;
+        //! Delays the search while the user is typing.
+        QTimer *queryTimer_;
+};
+
+} // dialogs
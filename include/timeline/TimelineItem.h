@@ -119,6 +119,8 @@ public:
 
         //! Add a user avatar for this event.
         void addAvatar();
+        //! Show the display name & the avatar of the sender, once its room is loaded.
+        void refreshSender();
 
 protected:
         void paintEvent(QPaintEvent *event) override;
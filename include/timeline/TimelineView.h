@@ -139,6 +139,13 @@ public:
 
         //! Remove an item from the timeline with the given Event ID.
         void removeEvent(const QString &event_id);
+        //! The rendered events were restored from the cache.
+        void setRestored() { isRestored_ = true; }
+        //! Show the names & avatars of the senders once the members are loaded.
+        void refreshSenders();
+        //! Scroll to the event. The older messages are paginated until it's
+        //! found, up to MAX_SCROLL_PAGES.
+        void scrollToEvent(const QString &event_id);
 
 public slots:
         void sliderRangeChanged(int min, int max);
@@ -149,7 +156,11 @@ public slots:
         void addBackwardsEvents(const QString &room_id, const mtx::responses::Messages &msgs);
 
         // Whether or not the initial batch has been loaded.
-        bool hasLoaded() { return scroll_layout_->count() > 1 || isTimelineFinished; }
+        bool hasLoaded()
+        {
+                return scroll_layout_->count() > 1 || !bottomMessages_.empty() ||
+                       isTimelineFinished;
+        }
 
         void handleFailedMessage(int txnid);
 
@@ -181,6 +192,8 @@ private:
         //! Decides whether or not to show or hide the scroll down button.
         void toggleScrollDownButton();
         void init();
+        //! Remove the rendered events, except the pending messages.
+        void clearTimeline();
         void addTimelineItem(TimelineItem *item,
                              TimelineDirection direction = TimelineDirection::Bottom);
         void updateLastSender(const QString &user_id, TimelineDirection direction);
@@ -245,13 +258,24 @@ private:
         QString local_user_;
 
         bool isPaginationInProgress_ = false;
+        //! Set while the rendered events come from the cache & no sync
+        //! has been received.
+        bool isRestored_ = false;
+        //! The token of a pagination that was started before the timeline
+        //! was cleared. Its response is dropped.
+        QString discardedToken_;
+        //! The event to scroll to once it's rendered.
+        QString scrollTarget_;
+        //! The pages that can still be paginated to find the scroll target.
+        int scrollPages_ = 0;
 
         // Keeps track whether or not the user has visited the view.
         bool isInitialized      = false;
         bool isTimelineFinished = false;
         bool isInitialSync      = true;
 
-        const int SCROLL_BAR_GAP = 200;
+        const int SCROLL_BAR_GAP   = 200;
+        const int MAX_SCROLL_PAGES = 20;
 
         QTimer *paginationTimer_;
 
@@ -292,7 +316,7 @@ TimelineView::addUserMessage(const QString &url,
         auto with_sender = lastSender_ != local_user_;
         auto trimmed     = QFileInfo{filename}.fileName(); // Trim file path.
 
-        auto widget = new Widget(client_, url, trimmed, size, this);
+        auto widget = new Widget(client_, room_id_, url, trimmed, size, this);
 
         TimelineItem *view_item =
           new TimelineItem(widget, local_user_, with_sender, room_id_, scroll_widget_);
@@ -323,7 +347,7 @@ template<class Event, class Widget>
 TimelineItem *
 TimelineView::createTimelineItem(const Event &event, bool withSender)
 {
-        auto eventWidget = new Widget(client_, event);
+        auto eventWidget = new Widget(client_, room_id_, event);
         auto item = new TimelineItem(eventWidget, event, withSender, room_id_, scroll_widget_);
 
         return item;
@@ -38,10 +38,10 @@ public:
 
         // Initialize with timeline events.
         void initialize(const mtx::responses::Rooms &rooms);
-        // Empty initialization.
-        void initialize(const std::vector<std::string> &rooms);
+        // Initialize with the timelines saved in the cache.
+        void initialize(const std::map<QString, mtx::responses::Timeline> &timelines);
 
-        void addRoom(const mtx::responses::JoinedRoom &room, const QString &room_id);
+        void addRoom(const mtx::responses::Timeline &timeline, const QString &room_id);
         void addRoom(const QString &room_id);
 
         void sync(const mtx::responses::Rooms &rooms);
@@ -58,6 +58,11 @@ signals:
 
 public slots:
         void setHistoryView(const QString &room_id);
+        //! Refresh the senders of the room once its members are loaded.
+        void refreshSenders(const QString &room_id);
+        //! Scroll the timeline of the room to the event, loading the older
+        //! messages if it isn't shown yet.
+        void scrollToEvent(const QString &room_id, const QString &event_id);
         void queueTextMessage(const QString &msg);
         void queueEmoteMessage(const QString &msg);
         void queueImageMessage(const QString &roomid,
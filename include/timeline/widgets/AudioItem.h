@@ -43,10 +43,12 @@ class AudioItem : public QWidget
 
 public:
         AudioItem(QSharedPointer<MatrixClient> client,
+                  const QString &room_id,
                   const mtx::events::RoomEvent<mtx::events::msg::Audio> &event,
                   QWidget *parent = nullptr);
 
         AudioItem(QSharedPointer<MatrixClient> client,
+                  const QString &room_id,
                   const QString &url,
                   const QString &filename,
                   uint64_t size,
@@ -91,6 +93,8 @@ private:
 
         mtx::events::RoomEvent<mtx::events::msg::Audio> event_;
         QSharedPointer<MatrixClient> client_;
+        //! The room of the event. Its downloads are scheduled with it.
+        QString room_id_;
 
         QMediaPlayer *player_;
 
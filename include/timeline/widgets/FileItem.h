@@ -37,10 +37,12 @@ class FileItem : public QWidget
 
 public:
         FileItem(QSharedPointer<MatrixClient> client,
+                 const QString &room_id,
                  const mtx::events::RoomEvent<mtx::events::msg::File> &event,
                  QWidget *parent = nullptr);
 
         FileItem(QSharedPointer<MatrixClient> client,
+                 const QString &room_id,
                  const QString &url,
                  const QString &filename,
                  uint64_t size,
@@ -72,6 +74,8 @@ private:
 
         mtx::events::RoomEvent<mtx::events::msg::File> event_;
         QSharedPointer<MatrixClient> client_;
+        //! The room of the event. Its downloads are scheduled with it.
+        QString room_id_;
 
         QIcon icon_;
 
@@ -35,10 +35,12 @@ class ImageItem : public QWidget
         Q_OBJECT
 public:
         ImageItem(QSharedPointer<MatrixClient> client,
+                  const QString &room_id,
                   const mtx::events::RoomEvent<mtx::events::msg::Image> &event,
                   QWidget *parent = nullptr);
 
         ImageItem(QSharedPointer<MatrixClient> client,
+                  const QString &room_id,
                   const QString &url,
                   const QString &filename,
                   uint64_t size,
@@ -80,4 +82,6 @@ private:
         mtx::events::RoomEvent<mtx::events::msg::Image> event_;
 
         QSharedPointer<MatrixClient> client_;
+        //! The room of the event. Its downloads are scheduled with it.
+        QString room_id_;
 };
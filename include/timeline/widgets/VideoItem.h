@@ -32,10 +32,12 @@ class VideoItem : public QWidget
 
 public:
         VideoItem(QSharedPointer<MatrixClient> client,
+                  const QString &room_id,
                   const mtx::events::RoomEvent<mtx::events::msg::Video> &event,
                   QWidget *parent = nullptr);
 
         VideoItem(QSharedPointer<MatrixClient> client,
+                  const QString &room_id,
                   const QString &url,
                   const QString &filename,
                   uint64_t size,
@@ -0,0 +1,47 @@
+#!/bin/bash -e
+
+#
+# Compare the sync save time of two revisions.
+#
+# usage: scripts/benchmark_save_state.sh <baseline-revision> [<revision>]
+#
+# The benchmark sources of the working tree are copied into both revisions,
+# so they only need the public Cache API.
+#
+
+BASELINE=$1
+REVISION=${2:-HEAD}
+ROOT=$(git rev-parse --show-toplevel)
+WORKDIR=$(mktemp -d)
+
+cleanup() {
+    git -C "${ROOT}" worktree remove --force "${WORKDIR}/baseline" || true
+    git -C "${ROOT}" worktree remove --force "${WORKDIR}/revision" || true
+    rm -rf "${WORKDIR}"
+}
+trap cleanup EXIT
+
+for TREE in baseline revision; do
+    if [ "${TREE}" = baseline ]; then
+        REV=${BASELINE}
+    else
+        REV=${REVISION}
+    fi
+
+    SOURCE="${WORKDIR}/${TREE}"
+    BUILD="${WORKDIR}/build-${TREE}"
+
+    git -C "${ROOT}" worktree add --detach "${SOURCE}" "${REV}" > /dev/null
+
+    rm -rf "${SOURCE}/benchmarks"
+    cp -R "${ROOT}/benchmarks" "${SOURCE}/"
+    if ! grep -q "add_subdirectory(benchmarks)" "${SOURCE}/CMakeLists.txt"; then
+        echo "add_subdirectory(benchmarks)" >> "${SOURCE}/CMakeLists.txt"
+    fi
+
+    cmake -H"${SOURCE}" -B"${BUILD}" -DCMAKE_BUILD_TYPE=Release -DBUILD_BENCHMARKS=ON > /dev/null
+    cmake --build "${BUILD}" --target save_state_benchmark -- -j"$(nproc)" > /dev/null
+
+    echo "== ${TREE} (${REV})"
+    "${BUILD}/benchmarks/save_state_benchmark"
+done
@@ -31,13 +31,9 @@ AvatarProvider::resolve(const QString &room_id,
                         QObject *receiver,
                         std::function<void(QImage)> callback)
 {
-        const auto key       = QString("%1 %2").arg(room_id).arg(user_id);
         const auto avatarUrl = Cache::avatarUrl(room_id, user_id);
 
-        if (!Cache::AvatarUrls.contains(key) || cache_.isNull())
-                return;
-
-        if (avatarUrl.isEmpty())
+        if (avatarUrl.isEmpty() || cache_.isNull())
                 return;
 
         auto data = cache_->image(avatarUrl);
@@ -46,7 +42,7 @@ AvatarProvider::resolve(const QString &room_id,
                 return;
         }
 
-        auto proxy = client_->fetchUserAvatar(avatarUrl);
+        auto proxy = client_->fetchUserAvatar(avatarUrl, room_id);
 
         if (proxy.isNull())
                 return;
@@ -15,21 +15,43 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <set>
 #include <stdexcept>
+#include <tuple>
 
 #include <QByteArray>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QHash>
+#include <QSettings>
 #include <QStandardPaths>
+#include <QtConcurrent>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
 
 #include <variant.hpp>
 
 #include "Cache.h"
+#include "LmdbUtils.h"
 
 //! Should be changed when a breaking change occurs in the cache format.
 //! This will reset client's data.
-static const std::string CURRENT_CACHE_FORMAT_VERSION("2018.04.21");
+static const std::string CURRENT_CACHE_FORMAT_VERSION("2018.05.20");
+//! The last format that stored the records as JSON.
+static const std::string JSON_CACHE_FORMAT_VERSION("2018.04.21");
+//! The last format that stored the read receipts as JSON.
+static const std::string JSON_RECEIPTS_FORMAT_VERSION("2018.05.11");
+//! The last format that used separate databases per room.
+static const std::string ROOM_DBS_FORMAT_VERSION("2018.05.13");
+//! The last format without the search index.
+static const std::string SHARED_TABLES_FORMAT_VERSION("2018.05.15");
 
 static const lmdb::val NEXT_BATCH_KEY("next_batch");
 static const lmdb::val CACHE_FORMAT_VERSION_KEY("cache_format_version");
@@ -40,399 +62,2180 @@ static const lmdb::val CACHE_FORMAT_VERSION_KEY("cache_format_version");
 //! Format: room_id -> RoomInfo
 static constexpr const char *ROOMS_DB   = "rooms";
 static constexpr const char *INVITES_DB = "invites";
-//! Keeps already downloaded media for reuse.
-//! Format: matrix_url -> binary data.
-static constexpr const char *MEDIA_DB = "media";
+//! State events of the joined rooms.
+//! Format: room_id\0event_type\0state_key -> StateEvent
+static constexpr const char *ROOM_STATE_DB = "room_state";
+//! Members of the joined rooms.
+//! Format: room_id\0user_id -> MemberInfo
+static constexpr const char *ROOM_MEMBERS_DB = "room_members";
+//! Stripped state events of the invites.
+//! Format: room_id\0event_type\0state_key -> StrippedEvent
+static constexpr const char *INVITE_STATE_DB = "invite_state";
+//! Members of the invites.
+//! Format: room_id\0user_id -> MemberInfo
+static constexpr const char *INVITE_MEMBERS_DB = "invite_members";
+//! Summaries used to calculate the name & avatar of the joined rooms.
+//! Format: room_id -> RoomSummary
+static constexpr const char *ROOM_SUMMARIES_DB = "room_summaries";
+//! Last message & unread count shown in the room list.
+//! Format: room_id -> RoomListEntry
+static constexpr const char *ROOM_LIST_DB = "room_list";
+//! Latest timeline events of the joined rooms.
+//! Format: room_id\0sequence_number -> {event, prev_batch token}
+static constexpr const char *ROOM_MESSAGES_DB = "room_messages";
+//! Used to keep the downloaded media before they were moved to the MediaCache.
+static constexpr const char *LEGACY_MEDIA_DB = "media";
 //! Information that  must be kept between sync requests.
 static constexpr const char *SYNC_STATE_DB = "sync_state";
 //! Read receipts per room/event.
+//! Format: room_id\0event_id\0user_id -> timestamp
 static constexpr const char *READ_RECEIPTS_DB = "read_receipts";
+//! The event of the latest read receipt per room/user.
+//! Format: room_id\0user_id -> event_id
+static constexpr const char *LATEST_RECEIPTS_DB = "read_receipts_latest";
+
+//! Initial size of the memory map.
+static constexpr std::size_t INITIAL_MAP_SIZE = 256UL * 1024UL * 1024UL; /* 256 MB */
+//! Default upper limit of the memory map.
+static const uint64_t DEFAULT_MAX_MAP_SIZE =
+  sizeof(std::size_t) > 4 ? 8ULL * 1024ULL * 1024ULL * 1024ULL  /* 8 GB */
+                          : 1ULL * 1024ULL * 1024ULL * 1024ULL; /* 1 GB */
+
+//! Maximum number of timeline events kept per room.
+static constexpr std::size_t MAX_STORED_MESSAGES = 100;
+//! Number of timeline events used to render a room on startup. The batch of
+//! the oldest one is restored whole.
+static constexpr std::size_t MAX_RESTORED_MESSAGES = 30;
+//! Number of members kept in a room summary to calculate its name & avatar.
+static constexpr std::size_t MAX_ROOM_HEROES = 5;
+
+//! How often the batched mode syncs the environment, in seconds.
+static constexpr int DEFAULT_SYNC_INTERVAL = 5;
+
+//! Describes an exported cache snapshot.
+static constexpr const char *MANIFEST_FILE = "manifest.json";
+
+//! Number of orphaned rooms or databases removed per transaction by the garbage collection.
+static constexpr std::size_t GC_BATCH_SIZE = 16;
+
+//! Name of the LMDB data file in the environment's directory.
+static constexpr const char *DATA_FILE = "data.mdb";
+//! The cache is compacted on startup when the free pages take up at least
+//! this part of the data file ...
+static constexpr double COMPACT_FREE_RATIO = 0.5;
+//! ... and add up to at least this size.
+static constexpr uint64_t COMPACT_MIN_FREE_SIZE = 32UL * 1024UL * 1024UL; /* 32 MB */
 
 using CachedReceipts = std::multimap<uint64_t, std::string, std::greater<uint64_t>>;
 using Receipts       = std::map<std::string, std::map<std::string, uint64_t>>;
 
-Cache::Cache(const QString &userId, QObject *parent)
-  : QObject{parent}
-  , env_{nullptr}
-  , syncStateDb_{0}
-  , roomsDb_{0}
-  , invitesDb_{0}
-  , mediaDb_{0}
-  , readReceiptsDb_{0}
-  , localUserId_{userId}
-{}
+//! Replace the destination file in a single step. Unlike rename(3), this also
+//! works on Windows when the destination exists. The failure is logged.
+static bool
+replaceFile(const QString &from, const QString &to)
+{
+#ifdef Q_OS_WIN
+        const auto source      = QDir::toNativeSeparators(from).toStdWString();
+        const auto destination = QDir::toNativeSeparators(to).toStdWString();
 
-void
-Cache::setup()
+        if (MoveFileExW(source.c_str(),
+                        destination.c_str(),
+                        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+                return true;
+
+        qCritical() << "failed to replace" << to << "error code:" << GetLastError();
+#else
+        const auto source      = QFile::encodeName(from);
+        const auto destination = QFile::encodeName(to);
+
+        if (std::rename(source.constData(), destination.constData()) == 0)
+                return true;
+
+        qCritical() << "failed to replace" << to << ":" << std::strerror(errno);
+#endif
+
+        return false;
+}
+
+//! Delete all the entries whose key starts with the given prefix.
+static void
+deletePrefix(lmdb::txn &txn, lmdb::dbi &db, const std::string &prefix)
 {
-        qDebug() << "Setting up cache";
+        std::vector<std::string> keys;
 
-        auto statePath = QString("%1/%2/state")
-                           .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
-                           .arg(QString::fromUtf8(localUserId_.toUtf8().toHex()));
+        auto cursor = lmdb::cursor::open(txn, db);
 
-        cacheDirectory_ = QString("%1/%2")
-                            .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
-                            .arg(QString::fromUtf8(localUserId_.toUtf8().toHex()));
+        lmdb::val key(prefix), value;
+        bool found = cursor.get(key, value, MDB_SET_RANGE);
 
-        bool isInitial = !QFile::exists(statePath);
+        while (found && hasPrefix(key, prefix)) {
+                keys.emplace_back(key.data(), key.size());
+                found = cursor.get(key, value, MDB_NEXT);
+        }
 
-        env_ = lmdb::env::create();
-        env_.set_mapsize(256UL * 1024UL * 1024UL); /* 256 MB */
-        env_.set_max_dbs(1024UL);
+        cursor.close();
 
-        if (isInitial) {
-                qDebug() << "First time initializing LMDB";
+        for (const auto &k : keys)
+                lmdb::dbi_del(txn, db, lmdb::val(k), nullptr);
+}
 
-                if (!QDir().mkpath(statePath)) {
-                        throw std::runtime_error(
-                          ("Unable to create state directory:" + statePath).toStdString().c_str());
-                }
+//! Call the function for every entry whose key starts with the prefix, until it
+//! returns false. The function receives the rest of the key and the value.
+template<class Fn>
+static void
+forEachWithPrefix(lmdb::txn &txn, lmdb::dbi &db, const std::string &prefix, Fn fn)
+{
+        auto cursor = lmdb::cursor::open(txn, db);
+
+        lmdb::val key(prefix), value;
+        bool found = cursor.get(key, value, MDB_SET_RANGE);
+
+        while (found && hasPrefix(key, prefix)) {
+                lmdb::val suffix(key.data() + prefix.size(), key.size() - prefix.size());
+
+                if (!fn(suffix, value))
+                        break;
+
+                found = cursor.get(key, value, MDB_NEXT);
         }
 
-        try {
-                env_.open(statePath.toStdString().c_str());
-        } catch (const lmdb::error &e) {
-                if (e.code() != MDB_VERSION_MISMATCH && e.code() != MDB_INVALID) {
-                        throw std::runtime_error("LMDB initialization failed" +
-                                                 std::string(e.what()));
-                }
+        cursor.close();
+}
 
-                qWarning() << "Resetting cache due to LMDB version mismatch:" << e.what();
+//! Number of entries whose key starts with the prefix.
+static std::size_t
+countWithPrefix(lmdb::txn &txn, lmdb::dbi &db, const std::string &prefix)
+{
+        std::size_t total = 0;
 
-                QDir stateDir(statePath);
+        forEachWithPrefix(txn, db, prefix, [&total](const lmdb::val &, const lmdb::val &) {
+                total++;
+                return true;
+        });
 
-                for (const auto &file : stateDir.entryList(QDir::NoDotAndDotDot)) {
-                        if (!stateDir.remove(file))
-                                throw std::runtime_error(
-                                  ("Unable to delete file " + file).toStdString().c_str());
-                }
+        return total;
+}
+
+//! Collect the rooms that have rows in the table but no entry in the owner database.
+//!
+//! The keys of the table must start with the room id, followed by '\0' or nothing.
+static void
+findOrphans(lmdb::txn &txn, lmdb::dbi &table, lmdb::dbi &owner, std::set<std::string> &orphans)
+{
+        auto cursor = lmdb::cursor::open(txn, table);
 
-                env_.open(statePath.toStdString().c_str());
+        lmdb::val key, value;
+        bool found = cursor.get(key, value, MDB_FIRST);
+
+        while (found) {
+                std::string room_id(key.data(), key.size());
+                room_id = room_id.substr(0, room_id.find('\0'));
+
+                lmdb::val unused;
+                if (!lmdb::dbi_get(txn, owner, lmdb::val(room_id), unused))
+                        orphans.insert(room_id);
+
+                // Skip the rest of the room's rows.
+                const auto next = room_id + '\x01';
+
+                key   = lmdb::val(next);
+                found = cursor.get(key, value, MDB_SET_RANGE);
         }
 
-        auto txn        = lmdb::txn::begin(env_);
-        syncStateDb_    = lmdb::dbi::open(txn, SYNC_STATE_DB, MDB_CREATE);
-        roomsDb_        = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
-        invitesDb_      = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
-        mediaDb_        = lmdb::dbi::open(txn, MEDIA_DB, MDB_CREATE);
-        readReceiptsDb_ = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
-        txn.commit();
+        cursor.close();
+}
 
-        qRegisterMetaType<RoomInfo>();
+//! Total number of pages used by the tables.
+static uint64_t
+tablePages(const Cache::Statistics &stats)
+{
+        uint64_t pages = 0;
+
+        for (const auto &table : stats.tables)
+                pages += table.pages;
+
+        return pages;
 }
 
-void
-Cache::saveImage(const QString &url, const QByteArray &image)
+//! Number of pages in the freelist, i.e the space a compaction would reclaim.
+static uint64_t
+countFreePages(lmdb::txn &txn)
 {
-        auto key = url.toUtf8();
+        uint64_t total = 0;
 
-        try {
-                auto txn = lmdb::txn::begin(env_);
+        // The freelist is kept in the database with handle 0.
+        // Format: txn_id -> [count, page numbers...]
+        auto cursor = lmdb::cursor::open(txn, 0);
 
-                lmdb::dbi_put(txn,
-                              mediaDb_,
-                              lmdb::val(key.data(), key.size()),
-                              lmdb::val(image.data(), image.size()));
+        lmdb::val txn_id, pages;
+        while (cursor.get(txn_id, pages, MDB_NEXT)) {
+                std::size_t count = 0;
+                std::memcpy(&count, pages.data(), sizeof(count));
 
-                txn.commit();
-        } catch (const lmdb::error &e) {
-                qCritical() << "saveImage:" << e.what();
+                total += count;
         }
+
+        cursor.close();
+
+        return total;
 }
 
-QByteArray
-Cache::image(const QString &url) const
+static std::string
+receiptKey(const std::string &room_id, const std::string &event_id, const std::string &user_id)
 {
-        if (url.isEmpty())
-                return QByteArray();
+        return room_id + '\0' + event_id + '\0' + user_id;
+}
 
-        auto key = url.toUtf8();
+//! Parse a JSON value without copying it out of the database.
+static json
+parseValue(const lmdb::val &value)
+{
+        return json::parse(value.data(), value.data() + value.size());
+}
 
+//! The pagination token saved along with a timeline event.
+static std::string
+timelineToken(const lmdb::val &value)
+{
         try {
-                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+                return parseValue(value).at("token").get<std::string>();
+        } catch (const json::exception &e) {
+                qWarning() << "failed to parse timeline event:" << e.what();
+        }
 
-                lmdb::val image;
+        return std::string();
+}
 
-                bool res = lmdb::dbi_get(txn, mediaDb_, lmdb::val(key.data(), key.size()), image);
+namespace record {
 
-                txn.commit();
+//! Layout version of the records written by this build.
+static constexpr uint8_t VERSION = 1;
 
-                if (!res)
-                        return QByteArray();
+//! RoomInfo flags.
+static constexpr uint8_t IS_INVITE = 1 << 0;
 
-                return QByteArray(image.data(), image.size());
-        } catch (const lmdb::error &e) {
-                qCritical() << "image:" << e.what() << url;
+static void
+appendField(std::string &buf, const std::string &field)
+{
+        const auto size = static_cast<uint32_t>(field.size());
+
+        for (std::size_t i = 0; i < sizeof(size); ++i)
+                buf.push_back(static_cast<char>((size >> (8 * i)) & 0xff));
+
+        buf.append(field);
+}
+
+//! Record fields are little-endian. Keys that need to sort use
+//! appendKeyUint64BE instead.
+static void
+appendUint64LE(std::string &buf, uint64_t value)
+{
+        for (std::size_t i = 0; i < sizeof(value); ++i)
+                buf.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+//! Sequential reader over the bytes of a record.
+class Reader
+{
+public:
+        Reader(const lmdb::val &data)
+          : pos_{data.data()}
+          , end_{data.data() + data.size()}
+        {}
+
+        bool byte(uint8_t &value)
+        {
+                if (pos_ == end_)
+                        return false;
+
+                value = static_cast<uint8_t>(*pos_++);
+                return true;
+        }
+
+        bool uint64(uint64_t &value)
+        {
+                if (end_ - pos_ < static_cast<std::ptrdiff_t>(sizeof(value)))
+                        return false;
+
+                value = 0;
+                for (std::size_t i = 0; i < sizeof(value); ++i)
+                        value |= static_cast<uint64_t>(static_cast<uint8_t>(*pos_++)) << (8 * i);
+
+                return true;
+        }
+
+        bool field(std::string &value)
+        {
+                uint32_t size = 0;
+
+                if (end_ - pos_ < static_cast<std::ptrdiff_t>(sizeof(size)))
+                        return false;
+
+                for (std::size_t i = 0; i < sizeof(size); ++i)
+                        size |= static_cast<uint32_t>(static_cast<uint8_t>(*pos_++)) << (8 * i);
+
+                if (end_ - pos_ < static_cast<std::ptrdiff_t>(size))
+                        return false;
+
+                value.assign(pos_, size);
+                pos_ += size;
+
+                return true;
         }
 
-        return QByteArray();
+private:
+        const char *pos_;
+        const char *end_;
+};
+
+std::string
+encode(const RoomInfo &info)
+{
+        std::string buf;
+        buf.reserve(2 + 3 * sizeof(uint32_t) + info.name.size() + info.topic.size() +
+                    info.avatar_url.size());
+
+        buf.push_back(static_cast<char>(VERSION));
+        buf.push_back(static_cast<char>(info.is_invite ? IS_INVITE : 0));
+
+        appendField(buf, info.name);
+        appendField(buf, info.topic);
+        appendField(buf, info.avatar_url);
+
+        return buf;
 }
 
-void
-Cache::removeInvite(lmdb::txn &txn, const std::string &room_id)
+std::string
+encode(const MemberInfo &info)
 {
-        lmdb::dbi_del(txn, invitesDb_, lmdb::val(room_id), nullptr);
-        lmdb::dbi_drop(txn, getInviteStatesDb(txn, room_id), true);
-        lmdb::dbi_drop(txn, getInviteMembersDb(txn, room_id), true);
+        std::string buf;
+        buf.reserve(1 + 2 * sizeof(uint32_t) + info.name.size() + info.avatar_url.size());
+
+        buf.push_back(static_cast<char>(VERSION));
+
+        appendField(buf, info.name);
+        appendField(buf, info.avatar_url);
+
+        return buf;
 }
 
-void
-Cache::removeInvite(const std::string &room_id)
+std::string
+encode(const RoomSummary &summary)
 {
-        auto txn = lmdb::txn::begin(env_);
-        removeInvite(txn, room_id);
-        txn.commit();
+        std::string buf;
+
+        buf.push_back(static_cast<char>(VERSION));
+        buf.push_back(static_cast<char>(summary.name_source));
+        buf.push_back(static_cast<char>(summary.avatar_source));
+
+        appendUint64LE(buf, summary.member_count);
+
+        buf.push_back(static_cast<char>(summary.heroes.size()));
+        for (const auto &hero : summary.heroes)
+                appendField(buf, hero);
+
+        return buf;
+}
+
+std::string
+encode(const RoomListEntry &entry)
+{
+        std::string buf;
+        buf.reserve(1 + 3 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + entry.user_id.size() +
+                    entry.username.size() + entry.body.size());
+
+        buf.push_back(static_cast<char>(VERSION));
+
+        appendField(buf, entry.user_id);
+        appendField(buf, entry.username);
+        appendField(buf, entry.body);
+        appendUint64LE(buf, entry.timestamp);
+        appendUint64LE(buf, entry.unread_count);
+
+        return buf;
+}
+
+bool
+decode(const lmdb::val &data, RoomInfo &info)
+{
+        Reader reader(data);
+        uint8_t version = 0, flags = 0;
+
+        if (!reader.byte(version) || version != VERSION || !reader.byte(flags))
+                return false;
+
+        info.is_invite = flags & IS_INVITE;
+
+        return reader.field(info.name) && reader.field(info.topic) &&
+               reader.field(info.avatar_url);
+}
+
+bool
+decode(const lmdb::val &data, MemberInfo &info)
+{
+        Reader reader(data);
+        uint8_t version = 0;
+
+        if (!reader.byte(version) || version != VERSION)
+                return false;
+
+        return reader.field(info.name) && reader.field(info.avatar_url);
+}
+
+bool
+decode(const lmdb::val &data, RoomSummary &summary)
+{
+        Reader reader(data);
+        uint8_t version = 0, name_source = 0, avatar_source = 0, heroes = 0;
+
+        if (!reader.byte(version) || version != VERSION || !reader.byte(name_source) ||
+            !reader.byte(avatar_source) || !reader.uint64(summary.member_count) ||
+            !reader.byte(heroes))
+                return false;
+
+        // The sources are stored as bytes, so anything past the last one is corrupt.
+        if (name_source > static_cast<uint8_t>(RoomSummary::NameSource::CanonicalAlias) ||
+            avatar_source > static_cast<uint8_t>(RoomSummary::AvatarSource::Member))
+                return false;
+
+        summary.name_source   = static_cast<RoomSummary::NameSource>(name_source);
+        summary.avatar_source = static_cast<RoomSummary::AvatarSource>(avatar_source);
+
+        summary.heroes.resize(heroes);
+        for (auto &hero : summary.heroes) {
+                if (!reader.field(hero))
+                        return false;
+        }
+
+        return true;
+}
+
+bool
+decode(const lmdb::val &data, RoomListEntry &entry)
+{
+        Reader reader(data);
+        uint8_t version = 0;
+
+        if (!reader.byte(version) || version != VERSION)
+                return false;
+
+        return reader.field(entry.user_id) && reader.field(entry.username) &&
+               reader.field(entry.body) && reader.uint64(entry.timestamp) &&
+               reader.uint64(entry.unread_count);
+}
+}
+
+//! Convert the JSON records of the database to the binary format.
+template<class T>
+static void
+migrateRecords(lmdb::txn &txn, lmdb::dbi &db)
+{
+        std::vector<std::pair<std::string, std::string>> records;
+
+        auto cursor = lmdb::cursor::open(txn, db);
+
+        lmdb::val key, value;
+        while (cursor.get(key, value, MDB_NEXT)) {
+                T info = parseValue(value);
+                records.emplace_back(std::string(key.data(), key.size()), record::encode(info));
+        }
+
+        cursor.close();
+
+        for (const auto &r : records)
+                lmdb::dbi_put(txn, db, lmdb::val(r.first), lmdb::val(r.second));
+}
+
+//! Parse the durability setting, falling back to the safe mode.
+static Cache::Durability
+parseDurability(const QString &mode)
+{
+        if (mode == "batched")
+                return Cache::Durability::Batched;
+        else if (mode == "ephemeral")
+                return Cache::Durability::Ephemeral;
+        else if (mode != "safe")
+                qWarning() << "unknown cache durability mode:" << mode;
+
+        return Cache::Durability::Safe;
+}
+
+//! Read all the room info records of the database.
+static void
+readRoomInfo(lmdb::txn &txn, lmdb::dbi &db, RoomInfoTable::Rooms &rooms)
+{
+        auto cursor = lmdb::cursor::open(txn, db);
+
+        lmdb::val room_id, data;
+        while (cursor.get(room_id, data, MDB_NEXT)) {
+                RoomInfo info;
+
+                if (record::decode(data, info))
+                        rooms.insert(QString::fromUtf8(room_id.data(), room_id.size()),
+                                     std::move(info));
+                else
+                        qWarning() << "failed to decode room info:"
+                                   << QString::fromUtf8(room_id.data(), room_id.size());
+        }
+
+        cursor.close();
 }
 
 void
-Cache::removeRoom(lmdb::txn &txn, const std::string &roomid)
+RoomInfoTable::setLoader(Loader loader)
 {
-        lmdb::dbi_del(txn, roomsDb_, lmdb::val(roomid), nullptr);
-        lmdb::dbi_drop(txn, getStatesDb(txn, roomid), true);
-        lmdb::dbi_drop(txn, getMembersDb(txn, roomid), true);
+        std::lock_guard<std::mutex> lock(mutex_);
+        loader_ = std::move(loader);
 }
 
 void
-Cache::removeRoom(const std::string &roomid)
+RoomInfoTable::clear()
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, 0);
-        lmdb::dbi_del(txn, roomsDb_, lmdb::val(roomid), nullptr);
-        txn.commit();
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        loaded_ = false;
+        joined_.clear();
+        invites_.clear();
+        all_.clear();
 }
 
 void
-Cache::setNextBatchToken(lmdb::txn &txn, const std::string &token)
+RoomInfoTable::load()
 {
-        lmdb::dbi_put(txn, syncStateDb_, NEXT_BATCH_KEY, lmdb::val(token.data(), token.size()));
+        if (loaded_ || !loader_)
+                return;
+
+        Rooms joined, invites;
+
+        try {
+                loader_(joined, invites);
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to load the room info:" << e.what();
+                return;
+        }
+
+        joined_  = std::move(joined);
+        invites_ = std::move(invites);
+
+        all_ = joined_;
+        for (auto it = invites_.constBegin(); it != invites_.constEnd(); ++it)
+                all_.insert(it.key(), it.value());
+
+        loaded_ = true;
 }
 
 void
-Cache::setNextBatchToken(lmdb::txn &txn, const QString &token)
+RoomInfoTable::refresh(const QString &room_id)
 {
-        setNextBatchToken(txn, token.toStdString());
+        auto invite = invites_.constFind(room_id);
+        if (invite != invites_.constEnd()) {
+                all_.insert(room_id, invite.value());
+                return;
+        }
+
+        auto room = joined_.constFind(room_id);
+        if (room != joined_.constEnd())
+                all_.insert(room_id, room.value());
+        else
+                all_.remove(room_id);
+}
+
+RoomInfoTable::Rooms
+RoomInfoTable::all()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        load();
+
+        // Implicitly shared; the copy is made by the next write.
+        return all_;
+}
+
+RoomInfoTable::Rooms
+RoomInfoTable::joined()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        load();
+
+        return joined_;
 }
 
 bool
-Cache::isInitialized() const
+RoomInfoTable::find(const QString &room_id, RoomInfo &info)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        lmdb::val token;
+        std::lock_guard<std::mutex> lock(mutex_);
+        load();
 
-        bool res = lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
+        auto room = joined_.constFind(room_id);
+        if (room != joined_.constEnd()) {
+                info = room.value();
+                return true;
+        }
 
-        txn.commit();
+        auto invite = invites_.constFind(room_id);
+        if (invite != invites_.constEnd()) {
+                info = invite.value();
+                return true;
+        }
 
-        return res;
+        return false;
 }
 
-QString
-Cache::nextBatchToken() const
+void
+RoomInfoTable::putRoom(const QString &room_id, const RoomInfo &info)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        lmdb::val token;
+        pending_.push_back(Change{room_id, info, false, false});
+}
 
-        lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
+void
+RoomInfoTable::removeRoom(const QString &room_id)
+{
+        pending_.push_back(Change{room_id, RoomInfo(), false, true});
+}
 
-        txn.commit();
+void
+RoomInfoTable::putInvite(const QString &room_id, const RoomInfo &info)
+{
+        pending_.push_back(Change{room_id, info, true, false});
+}
 
-        return QString::fromUtf8(token.data(), token.size());
+void
+RoomInfoTable::removeInvite(const QString &room_id)
+{
+        pending_.push_back(Change{room_id, RoomInfo(), true, true});
 }
 
 void
-Cache::deleteData()
+RoomInfoTable::commit()
 {
-        qInfo() << "Deleting cache data";
+        if (pending_.empty())
+                return;
 
-        if (!cacheDirectory_.isEmpty())
-                QDir(cacheDirectory_).removeRecursively();
+        std::vector<Change> changes;
+        std::swap(changes, pending_);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // The committed changes are part of the next load.
+        if (!loaded_)
+                return;
+
+        for (const auto &change : changes) {
+                auto &rooms = change.invite ? invites_ : joined_;
+
+                if (change.removed)
+                        rooms.remove(change.room_id);
+                else
+                        rooms.insert(change.room_id, change.info);
+
+                refresh(change.room_id);
+        }
+}
+
+void
+RoomInfoTable::discard()
+{
+        pending_.clear();
 }
 
-bool
-Cache::isFormatValid()
-{
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+Cache::Cache(const QString &userId, QObject *parent)
+  : QObject{parent}
+  , env_{nullptr}
+  , mapSize_{0}
+  , maxMapSize_{0}
+  , durability_{Durability::Safe}
+  , syncStateDb_{0}
+  , roomsDb_{0}
+  , invitesDb_{0}
+  , roomStateDb_{0}
+  , roomMembersDb_{0}
+  , inviteStateDb_{0}
+  , inviteMembersDb_{0}
+  , roomMessagesDb_{0}
+  , roomSummariesDb_{0}
+  , roomListDb_{0}
+  , readReceiptsDb_{0}
+  , latestReceiptsDb_{0}
+  , localUserId_{userId}
+{
+        mediaWriter_.setMaxThreadCount(1);
+        maintenance_.setMaxThreadCount(1);
+
+        syncTimer_ = new QTimer(this);
+        connect(syncTimer_, &QTimer::timeout, this, [this]() {
+                // Don't block the UI while the data is flushed.
+                if (!writer_.isNull())
+                        writer_->post([this]() { syncEnvironment(); });
+        });
+}
+
+Cache::~Cache()
+{
+        // The loaders refer to this instance.
+        Members.setLoader(nullptr);
+        roomTable_.setLoader(nullptr);
+
+        // The maintenance tasks use the writer.
+        stopMaintenance();
+
+        // Commit the queued writes.
+        writer_.clear();
+        mediaWriter_.waitForDone();
+
+        syncEnvironment();
+}
+
+void
+Cache::setup()
+{
+        qDebug() << "Setting up cache";
+
+        stopMaintenance();
+        writer_.clear();
+
+        cacheDirectory_ = cacheDirectory();
+
+        const auto statePath = cacheDirectory_ + "/state";
+
+        bool isInitial = !QFile::exists(statePath);
+
+        // The idle transactions belong to the previous environment.
+        readers_.clear();
+
+        QSettings settings;
+        maxMapSize_ = static_cast<std::size_t>(
+          settings.value("cache/max_map_size", qulonglong(DEFAULT_MAX_MAP_SIZE)).toULongLong());
+        durability_ = parseDurability(settings.value("cache/durability", "safe").toString());
+
+        if (isInitial) {
+                qDebug() << "First time initializing LMDB";
+
+                if (!QDir().mkpath(statePath)) {
+                        throw std::runtime_error(
+                          ("Unable to create state directory:" + statePath).toStdString().c_str());
+                }
+        }
+
+        try {
+                openEnvironment(statePath, std::min(INITIAL_MAP_SIZE, maxMapSize_));
+        } catch (const lmdb::error &e) {
+                if (e.code() != MDB_VERSION_MISMATCH && e.code() != MDB_INVALID) {
+                        throw std::runtime_error("LMDB initialization failed" +
+                                                 std::string(e.what()));
+                }
+
+                qWarning() << "Resetting cache due to LMDB version mismatch:" << e.what();
+
+                QDir stateDir(statePath);
+
+                for (const auto &file : stateDir.entryList(QDir::NoDotAndDotDot)) {
+                        if (!stateDir.remove(file))
+                                throw std::runtime_error(
+                                  ("Unable to delete file " + file).toStdString().c_str());
+                }
+
+                openEnvironment(statePath, std::min(INITIAL_MAP_SIZE, maxMapSize_));
+        }
+
+        auto txn = lmdb::txn::begin(env_);
+        openDatabases(txn);
+
+        // Free up the space taken by the media saved along with the room state.
+        try {
+                auto legacyMediaDb = lmdb::dbi::open(txn, LEGACY_MEDIA_DB);
+                lmdb::dbi_drop(txn, legacyMediaDb, true);
+        } catch (const lmdb::not_found_error &) {
+        }
+
+        txn.commit();
+
+        const auto mediaLimit =
+          settings.value("cache/media_size_limit", qulonglong(DEFAULT_MEDIA_SIZE_LIMIT))
+            .toULongLong();
+
+        media_ = QSharedPointer<MediaCache>(new MediaCache(cacheDirectory_ + "/media", mediaLimit));
+        media_->setup();
+
+        auto runner = [this](const CacheWriter::Write &batch) {
+                retryOnMapFull([this, &batch]() {
+                        auto lock = lockTxn();
+                        auto txn  = lmdb::txn::begin(env_);
+
+                        try {
+                                batch(txn);
+
+                                txn.commit();
+                        } catch (...) {
+                                // The changes are staged again if the batch is retried.
+                                roomTable_.discard();
+                                Members.discard();
+                                throw;
+                        }
+                });
+
+                roomTable_.commit();
+        };
+
+        writer_ = QSharedPointer<CacheWriter>(new CacheWriter(runner));
+
+        if (durability_ == Durability::Batched) {
+                const int interval =
+                  settings.value("cache/sync_interval", DEFAULT_SYNC_INTERVAL).toInt();
+                syncTimer_->start(std::max(interval, 1) * 1000);
+        } else {
+                syncTimer_->stop();
+        }
+
+        Members.clear();
+        Members.setLimit(
+          settings.value("cache/member_limit", qulonglong(DEFAULT_MEMBER_LIMIT)).toULongLong());
+        Members.setLoader(
+          [this](const QString &room_id, MemberDirectory::Members &members) {
+                  return loadMembers(room_id.toStdString(), members);
+          },
+          [this](const QString &room_id) { emit membersLoaded(room_id); });
+
+        roomTable_.clear();
+        roomTable_.setLoader([this](RoomInfoTable::Rooms &joined, RoomInfoTable::Rooms &invites) {
+                auto snapshot = readSnapshot();
+                auto &txn     = snapshot.txn();
+
+                readRoomInfo(txn, roomsDb_, joined);
+                readRoomInfo(txn, invitesDb_, invites);
+        });
+
+        qRegisterMetaType<RoomInfo>();
+        qRegisterMetaType<mtx::responses::Timeline>();
+}
+
+QString
+Cache::cacheDirectory() const
+{
+        return QString("%1/%2")
+          .arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+          .arg(QString::fromUtf8(localUserId_.toUtf8().toHex()));
+}
+
+//! Read the format version & the sync token of a cache environment, without
+//! locking it or writing to it.
+static bool
+readSyncState(const QString &path, std::string &version, std::string &token)
+{
+        try {
+                auto env = lmdb::env::create();
+                env.set_max_dbs(1024UL);
+                env.open(path.toStdString().c_str(), MDB_RDONLY | MDB_NOLOCK);
+
+                auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+                auto db  = lmdb::dbi::open(txn, SYNC_STATE_DB);
+
+                lmdb::val value;
+
+                if (!lmdb::dbi_get(txn, db, CACHE_FORMAT_VERSION_KEY, value))
+                        return false;
+                version.assign(value.data(), value.size());
+
+                if (!lmdb::dbi_get(txn, db, NEXT_BATCH_KEY, value))
+                        return false;
+                token.assign(value.data(), value.size());
+
+                txn.commit();
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to read the sync state of" << path << e.what();
+                return false;
+        }
+
+        return true;
+}
+
+bool
+Cache::exportSnapshot(const QString &path)
+{
+        if (QFile::exists(path + "/" + DATA_FILE)) {
+                qCritical() << "the export directory already contains a cache:" << path;
+                return false;
+        }
+
+        if (!QDir().mkpath(path)) {
+                qCritical() << "unable to create the export directory:" << path;
+                return false;
+        }
+
+        flush();
+
+        try {
+                lmdb::env_copy(env_.handle(), path.toStdString().c_str(), MDB_CP_COMPACT);
+        } catch (const lmdb::error &e) {
+                qCritical() << "failed to export the cache:" << e.what();
+                return false;
+        }
+
+        // The manifest describes the copy, so it's read back from it.
+        std::string version, token;
+        if (!readSyncState(path, version, token)) {
+                qCritical() << "the cache has not completed an initial sync";
+                QFile::remove(path + "/" + DATA_FILE);
+                return false;
+        }
+
+        json manifest;
+        manifest["user_id"]        = localUserId_.toStdString();
+        manifest["format_version"] = version;
+        manifest["next_batch"]     = token;
+
+        QFile file(path + "/" + MANIFEST_FILE);
+        if (!file.open(QIODevice::WriteOnly) ||
+            file.write(QByteArray::fromStdString(manifest.dump(2))) < 0) {
+                qCritical() << "unable to write the snapshot manifest:" << file.fileName();
+                return false;
+        }
+
+        qInfo() << "exported the cache of" << localUserId_ << "at sync token"
+                << QString::fromStdString(token);
+
+        return true;
+}
+
+bool
+Cache::importSnapshot(const QString &path)
+{
+        QFile file(path + "/" + MANIFEST_FILE);
+        if (!file.open(QIODevice::ReadOnly)) {
+                qCritical() << "unable to read the snapshot manifest:" << file.fileName();
+                return false;
+        }
+
+        std::string user_id, manifest_version, manifest_token;
+
+        try {
+                const auto manifest = json::parse(file.readAll().toStdString());
+
+                user_id          = manifest.at("user_id");
+                manifest_version = manifest.at("format_version");
+                manifest_token   = manifest.at("next_batch");
+        } catch (const json::exception &e) {
+                qCritical() << "invalid snapshot manifest:" << e.what();
+                return false;
+        }
+
+        if (QString::fromStdString(user_id) != localUserId_) {
+                qCritical() << "the snapshot belongs to" << QString::fromStdString(user_id)
+                            << "instead of" << localUserId_;
+                return false;
+        }
+
+        std::string version, token;
+        if (!readSyncState(path, version, token) || version != manifest_version ||
+            token != manifest_token) {
+                qCritical() << "the snapshot data don't match the manifest";
+                return false;
+        }
+
+        // Older formats are upgraded by the migrations on the next start.
+        if (version != CURRENT_CACHE_FORMAT_VERSION && migrationPath(version).empty()) {
+                qCritical() << "unsupported cache format:" << QString::fromStdString(version);
+                return false;
+        }
+
+        const auto statePath = cacheDirectory() + "/state";
+
+        if (!QDir().mkpath(statePath)) {
+                qCritical() << "unable to create the state directory:" << statePath;
+                return false;
+        }
+
+        // Copy next to the destination first, so the cache is replaced in a single step.
+        const auto imported = statePath + "/" + DATA_FILE + ".import";
+
+        QFile::remove(imported);
+        if (!QFile::copy(path + "/" + DATA_FILE, imported)) {
+                qCritical() << "unable to copy the snapshot to" << imported;
+                return false;
+        }
+
+        if (!replaceFile(imported, statePath + "/" + DATA_FILE)) {
+                QFile::remove(imported);
+                return false;
+        }
+
+        qInfo() << "imported the cache of" << localUserId_ << "at sync token"
+                << QString::fromStdString(token);
+
+        return true;
+}
+
+void
+Cache::openEnvironment(const QString &path, std::size_t map_size)
+{
+        env_ = lmdb::env::create();
+        env_.set_mapsize(map_size);
+        env_.set_max_dbs(1024UL);
+        unsigned int flags = MDB_NOTLS;
+
+        if (durability_ == Durability::Batched)
+                flags |= MDB_NOSYNC;
+        else if (durability_ == Durability::Ephemeral)
+                flags |= MDB_NOSYNC | MDB_NOMETASYNC;
+
+        env_.open(path.toStdString().c_str(), flags);
+
+        // LMDB uses the size of the data file if it is larger than the
+        // requested map, i.e when the map was resized on a previous run.
+        MDB_envinfo info;
+        mdb_env_info(env_.handle(), &info);
+        mapSize_ = info.me_mapsize;
+}
+
+void
+Cache::syncEnvironment()
+{
+        if (durability_ != Durability::Batched)
+                return;
+
+        // Keep the environment from being resized or reopened while it's flushed.
+        auto lock = lockTxn();
+
+        if (env_.handle() == nullptr)
+                return;
+
+        try {
+                env_.sync(true);
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to sync the cache:" << e.what();
+        }
+}
+
+void
+Cache::flush()
+{
+        if (!writer_.isNull())
+                writer_->flush();
+
+        syncEnvironment();
+}
+
+void
+Cache::openDatabases(lmdb::txn &txn)
+{
+        syncStateDb_      = lmdb::dbi::open(txn, SYNC_STATE_DB, MDB_CREATE);
+        roomsDb_          = lmdb::dbi::open(txn, ROOMS_DB, MDB_CREATE);
+        invitesDb_        = lmdb::dbi::open(txn, INVITES_DB, MDB_CREATE);
+        roomStateDb_      = lmdb::dbi::open(txn, ROOM_STATE_DB, MDB_CREATE);
+        roomMembersDb_    = lmdb::dbi::open(txn, ROOM_MEMBERS_DB, MDB_CREATE);
+        inviteStateDb_    = lmdb::dbi::open(txn, INVITE_STATE_DB, MDB_CREATE);
+        inviteMembersDb_  = lmdb::dbi::open(txn, INVITE_MEMBERS_DB, MDB_CREATE);
+        roomMessagesDb_   = lmdb::dbi::open(txn, ROOM_MESSAGES_DB, MDB_CREATE);
+        roomSummariesDb_  = lmdb::dbi::open(txn, ROOM_SUMMARIES_DB, MDB_CREATE);
+        roomListDb_       = lmdb::dbi::open(txn, ROOM_LIST_DB, MDB_CREATE);
+        readReceiptsDb_   = lmdb::dbi::open(txn, READ_RECEIPTS_DB, MDB_CREATE);
+        latestReceiptsDb_ = lmdb::dbi::open(txn, LATEST_RECEIPTS_DB, MDB_CREATE);
+
+        search_.open(txn);
+}
+
+Cache::Statistics
+Cache::statistics()
+{
+        Statistics stats;
+
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
+
+        MDB_envinfo info;
+        mdb_env_info(env_.handle(), &info);
+
+        MDB_stat envStat;
+        mdb_env_stat(env_.handle(), &envStat);
+
+        stats.map_size   = info.me_mapsize;
+        stats.page_size  = envStat.ms_psize;
+        stats.used_pages = info.me_last_pgno + 1;
+        stats.free_pages = countFreePages(txn);
+
+        std::vector<std::pair<const char *, MDB_dbi>> tables = {
+          {SYNC_STATE_DB, syncStateDb_.handle()},
+          {ROOMS_DB, roomsDb_.handle()},
+          {INVITES_DB, invitesDb_.handle()},
+          {ROOM_STATE_DB, roomStateDb_.handle()},
+          {ROOM_MEMBERS_DB, roomMembersDb_.handle()},
+          {INVITE_STATE_DB, inviteStateDb_.handle()},
+          {INVITE_MEMBERS_DB, inviteMembersDb_.handle()},
+          {ROOM_MESSAGES_DB, roomMessagesDb_.handle()},
+          {ROOM_SUMMARIES_DB, roomSummariesDb_.handle()},
+          {ROOM_LIST_DB, roomListDb_.handle()},
+          {READ_RECEIPTS_DB, readReceiptsDb_.handle()},
+          {LATEST_RECEIPTS_DB, latestReceiptsDb_.handle()},
+        };
+
+        const auto searchTables = search_.databases();
+        tables.insert(tables.end(), searchTables.begin(), searchTables.end());
+
+        for (const auto &table : tables) {
+                MDB_stat s;
+                lmdb::dbi_stat(txn, table.second, &s);
+
+                TableStatistics t;
+                t.name    = table.first;
+                t.entries = s.ms_entries;
+                t.depth   = s.ms_depth;
+                t.pages   = s.ms_branch_pages + s.ms_leaf_pages + s.ms_overflow_pages;
+                t.size    = t.pages * s.ms_psize;
+
+                stats.tables.push_back(std::move(t));
+        }
+
+        return stats;
+}
+
+void
+Cache::compactIfNeeded()
+{
+        try {
+                const auto stats = statistics();
+
+                const uint64_t free_size = stats.free_pages * stats.page_size;
+
+                if (free_size < COMPACT_MIN_FREE_SIZE ||
+                    stats.free_pages < stats.used_pages * COMPACT_FREE_RATIO)
+                        return;
+
+                qInfo() << "cache has" << free_size << "free bytes, compacting";
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to retrieve the cache statistics:" << e.what();
+                return;
+        }
+
+        if (!maintenanceStopped_)
+                compact();
+}
+
+void
+Cache::runMaintenance(std::function<void(Cache &)> task)
+{
+        QtConcurrent::run(&maintenance_, [this, task]() {
+                if (maintenanceStopped_)
+                        return;
+
+                try {
+                        task(*this);
+                } catch (const lmdb::error &e) {
+                        qWarning() << "cache maintenance failed:" << e.what();
+                }
+        });
+}
+
+void
+Cache::stopMaintenance()
+{
+        maintenanceStopped_ = true;
+        maintenance_.waitForDone();
+        maintenanceStopped_ = false;
+}
+
+bool
+Cache::compact()
+{
+        if (writer_.isNull())
+                return false;
+
+        // The copy runs on the writer thread, so the writes wait for it while
+        // the reads go on.
+        bool compacted = false;
+        writer_->post([this, &compacted]() { compacted = compactEnvironment(); }).get();
+
+        return compacted;
+}
+
+bool
+Cache::compactEnvironment()
+{
+        const auto statePath   = cacheDirectory_ + "/state";
+        const auto compactPath = cacheDirectory_ + "/state.compact";
+
+        QDir(compactPath).removeRecursively();
+
+        if (!QDir().mkpath(compactPath)) {
+                qWarning() << "unable to create the compaction directory:" << compactPath;
+                return false;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        try {
+                auto lock = lockTxn();
+                lmdb::env_copy(env_.handle(), compactPath.toStdString().c_str(), MDB_CP_COMPACT);
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to compact the cache:" << e.what();
+                QDir(compactPath).removeRecursively();
+                return false;
+        }
+
+        // Wait for the readers only while the environment is swapped.
+        std::unique_lock<std::shared_timed_mutex> lock(mapMutex_);
+
+        readers_.clear();
+        env_.close();
+
+        // Replace the data file in a single step, so a crash leaves either
+        // the old or the compacted file in place.
+        const bool swapped =
+          replaceFile(compactPath + "/" + DATA_FILE, statePath + "/" + DATA_FILE);
+
+        QDir(compactPath).removeRecursively();
+
+        openEnvironment(statePath, mapSize_);
+
+        auto txn = lmdb::txn::begin(env_);
+        openDatabases(txn);
+        txn.commit();
+
+        if (swapped)
+                qInfo() << "cache compacted in" << timer.elapsed() << "ms";
+
+        return swapped;
+}
+
+bool
+Cache::growMap(std::size_t failed_size)
+{
+        // Wait for all the transactions to finish.
+        std::unique_lock<std::shared_timed_mutex> lock(mapMutex_);
+
+        // The map was already resized by another writer.
+        if (mapSize_ > failed_size)
+                return true;
+
+        if (mapSize_ >= maxMapSize_) {
+                qCritical() << "cache map reached its maximum size of" << maxMapSize_ << "bytes";
+                return false;
+        }
+
+        const std::size_t size = std::min(mapSize_ * 2, maxMapSize_);
+
+        readers_.clear();
+        env_.set_mapsize(size);
+        mapSize_ = size;
+
+        qInfo() << "cache map resized to" << size << "bytes";
+
+        return true;
+}
+
+void
+Cache::saveImage(const QString &url, const QByteArray &image)
+{
+        if (media_.isNull() || writer_.isNull())
+                return;
+
+        // The media are kept in their own environment, so their commits don't
+        // have to wait for the state writes or hold them up.
+        auto media = media_;
+        QtConcurrent::run(&mediaWriter_, [media, url, image]() { media->saveImage(url, image); });
+}
+
+QByteArray
+Cache::image(const QString &url) const
+{
+        if (media_.isNull())
+                return QByteArray();
+
+        return media_->image(url);
+}
+
+MediaCache::Statistics
+Cache::mediaStatistics() const
+{
+        if (media_.isNull())
+                return MediaCache::Statistics{0, 0, 0, 0, 0};
+
+        return media_->statistics();
+}
+
+void
+Cache::removeInvite(lmdb::txn &txn, const std::string &room_id)
+{
+        // The invites database doubles as the index of the known invites,
+        // so rooms that were never an invite don't touch the invite tables.
+        if (!lmdb::dbi_del(txn, invitesDb_, lmdb::val(room_id), nullptr))
+                return;
+
+        roomTable_.removeInvite(QString::fromStdString(room_id));
+
+        const auto prefix = room_id + '\0';
+
+        deletePrefix(txn, inviteStateDb_, prefix);
+        deletePrefix(txn, inviteMembersDb_, prefix);
+}
+
+void
+Cache::removeInvite(const std::string &room_id)
+{
+        if (writer_.isNull())
+                return;
+
+        writer_->enqueue([this, room_id](lmdb::txn &txn) { removeInvite(txn, room_id); });
+}
+
+void
+Cache::removeRoom(lmdb::txn &txn, const std::string &roomid)
+{
+        const auto prefix = roomid + '\0';
+
+        lmdb::dbi_del(txn, roomsDb_, lmdb::val(roomid), nullptr);
+        roomTable_.removeRoom(QString::fromStdString(roomid));
+        lmdb::dbi_del(txn, roomSummariesDb_, lmdb::val(roomid), nullptr);
+        lmdb::dbi_del(txn, roomListDb_, lmdb::val(roomid), nullptr);
+        deletePrefix(txn, roomStateDb_, prefix);
+        deletePrefix(txn, roomMembersDb_, prefix);
+        deletePrefix(txn, roomMessagesDb_, prefix);
+        removeReadReceipts(txn, roomid);
+        search_.removeRoom(txn, roomid);
+}
+
+void
+Cache::removeRoom(const std::string &roomid)
+{
+        if (writer_.isNull())
+                return;
+
+        writer_->enqueue([this, roomid](lmdb::txn &txn) { removeRoom(txn, roomid); });
+}
+
+uint64_t
+Cache::collectGarbage()
+{
+        if (writer_.isNull())
+                return 0;
+
+        const auto before = statistics();
+
+        std::set<std::string> rooms, invites;
+        std::vector<std::string> databases;
+
+        {
+                auto snapshot = readSnapshot();
+                auto &txn     = snapshot.txn();
+
+                for (auto table : {&roomStateDb_,
+                                   &roomMembersDb_,
+                                   &roomMessagesDb_,
+                                   &roomSummariesDb_,
+                                   &roomListDb_,
+                                   &readReceiptsDb_,
+                                   &latestReceiptsDb_})
+                        findOrphans(txn, *table, roomsDb_, rooms);
+
+                findOrphans(txn, inviteStateDb_, invitesDb_, invites);
+                findOrphans(txn, inviteMembersDb_, invitesDb_, invites);
+
+                // The per room databases of the older formats are named room_id/suffix.
+                auto maindb = lmdb::dbi::open(txn, nullptr);
+                auto cursor = lmdb::cursor::open(txn, maindb);
+
+                std::string name, unused;
+                while (cursor.get(name, unused, MDB_NEXT)) {
+                        if (name.find('/') != std::string::npos)
+                                databases.push_back(name);
+                }
+
+                cursor.close();
+        }
+
+        if (rooms.empty() && invites.empty() && databases.empty())
+                return 0;
+
+        // Each batch gets its own transaction, so the sweep doesn't hold up the
+        // other writes for long.
+        auto inBatches = [this](const std::vector<std::string> &ids,
+                                std::function<void(lmdb::txn &, const std::string &)> remove) {
+                for (std::size_t i = 0; i < ids.size(); i += GC_BATCH_SIZE) {
+                        // The rest is removed on the next run.
+                        if (maintenanceStopped_)
+                                return;
+
+                        const auto last = std::min(i + GC_BATCH_SIZE, ids.size());
+                        const std::vector<std::string> batch(ids.begin() + i, ids.begin() + last);
+
+                        writer_
+                          ->enqueue([batch, remove](lmdb::txn &txn) {
+                                  for (const auto &id : batch)
+                                          remove(txn, id);
+                          })
+                          .get();
+                }
+        };
+
+        inBatches({rooms.begin(), rooms.end()}, [this](lmdb::txn &txn, const std::string &id) {
+                // The room might have been joined since the scan.
+                lmdb::val unused;
+                if (!lmdb::dbi_get(txn, roomsDb_, lmdb::val(id), unused))
+                        removeRoom(txn, id);
+        });
+
+        inBatches({invites.begin(), invites.end()}, [this](lmdb::txn &txn, const std::string &id) {
+                lmdb::val unused;
+                if (lmdb::dbi_get(txn, invitesDb_, lmdb::val(id), unused))
+                        return;
+
+                deletePrefix(txn, inviteStateDb_, id + '\0');
+                deletePrefix(txn, inviteMembersDb_, id + '\0');
+        });
+
+        std::atomic<uint64_t> droppedPages{0};
+
+        inBatches(databases, [&droppedPages](lmdb::txn &txn, const std::string &name) {
+                try {
+                        auto db = lmdb::dbi::open(txn, name.c_str());
+
+                        MDB_stat s;
+                        lmdb::dbi_stat(txn, db, &s);
+                        droppedPages += s.ms_branch_pages + s.ms_leaf_pages + s.ms_overflow_pages;
+
+                        lmdb::dbi_drop(txn, db, true);
+                } catch (const lmdb::not_found_error &) {
+                }
+        });
+
+        const auto after = statistics();
+
+        const uint64_t beforePages = tablePages(before) + droppedPages;
+        const uint64_t afterPages  = tablePages(after);
+        const uint64_t reclaimed =
+          beforePages > afterPages ? (beforePages - afterPages) * after.page_size : 0;
+
+        qInfo() << "cache garbage collection removed" << rooms.size() << "rooms,"
+                << invites.size() << "invites &" << databases.size() << "databases,"
+                << "reclaimed" << reclaimed << "bytes";
+
+        return reclaimed;
+}
+
+void
+Cache::setNextBatchToken(lmdb::txn &txn, const std::string &token)
+{
+        lmdb::dbi_put(txn, syncStateDb_, NEXT_BATCH_KEY, lmdb::val(token.data(), token.size()));
+}
+
+void
+Cache::setNextBatchToken(lmdb::txn &txn, const QString &token)
+{
+        setNextBatchToken(txn, token.toStdString());
+}
+
+bool
+Cache::isInitialized() const
+{
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
+        lmdb::val token;
+
+        bool res = lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
+
+        return res;
+}
+
+QString
+Cache::nextBatchToken() const
+{
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
+        lmdb::val token;
+
+        lmdb::dbi_get(txn, syncStateDb_, NEXT_BATCH_KEY, token);
+
+        return QString::fromUtf8(token.data(), token.size());
+}
+
+void
+Cache::deleteData()
+{
+        qInfo() << "Deleting cache data";
+
+        // Commit the queued writes before removing the files.
+        stopMaintenance();
+        writer_.clear();
+        mediaWriter_.waitForDone();
+
+        Members.clear();
+        roomTable_.clear();
+        readers_.clear();
+
+        if (!cacheDirectory_.isEmpty())
+                QDir(cacheDirectory_).removeRecursively();
+}
+
+bool
+Cache::isFormatValid()
+{
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
+
+        lmdb::val current_version;
+        bool res = lmdb::dbi_get(txn, syncStateDb_, CACHE_FORMAT_VERSION_KEY, current_version);
+
+        if (!res)
+                return false;
+
+        std::string stored_version(current_version.data(), current_version.size());
+
+        if (stored_version != CURRENT_CACHE_FORMAT_VERSION) {
+                qWarning() << "Stored format version" << QString::fromStdString(stored_version);
+                qWarning() << "There are breaking changes in the cache format.";
+                return false;
+        }
+
+        return true;
+}
+
+std::string
+Cache::storedFormatVersion()
+{
+        auto snapshot = readSnapshot();
+
+        lmdb::val version;
+        if (!lmdb::dbi_get(snapshot.txn(), syncStateDb_, CACHE_FORMAT_VERSION_KEY, version))
+                return std::string();
+
+        return std::string(version.data(), version.size());
+}
+
+const std::vector<Cache::Migration> &
+Cache::migrations()
+{
+        static const std::vector<Migration> list = {
+          {JSON_CACHE_FORMAT_VERSION, JSON_RECEIPTS_FORMAT_VERSION, &Cache::migrateToBinaryRecords},
+          {JSON_RECEIPTS_FORMAT_VERSION, ROOM_DBS_FORMAT_VERSION, &Cache::migrateReadReceipts},
+          {ROOM_DBS_FORMAT_VERSION, SHARED_TABLES_FORMAT_VERSION, &Cache::migrateToSharedTables},
+          {SHARED_TABLES_FORMAT_VERSION,
+           CURRENT_CACHE_FORMAT_VERSION,
+           &Cache::migrateToSearchIndex},
+        };
+
+        return list;
+}
+
+std::vector<const Cache::Migration *>
+Cache::migrationPath(const std::string &version)
+{
+        std::vector<const Migration *> path;
+
+        auto current = version;
+
+        for (const auto &migration : migrations()) {
+                if (migration.from == current) {
+                        path.push_back(&migration);
+                        current = migration.to;
+                }
+        }
+
+        if (current != CURRENT_CACHE_FORMAT_VERSION)
+                return {};
+
+        return path;
+}
+
+bool
+Cache::needsMigration()
+{
+        return !migrationPath(storedFormatVersion()).empty();
+}
+
+void
+Cache::runMigrations()
+{
+        const auto path = migrationPath(storedFormatVersion());
+
+        if (path.empty())
+                return;
+
+        const int total = static_cast<int>(path.size());
+
+        for (int i = 0; i < total; ++i) {
+                const auto &migration = *path[i];
+
+                qInfo() << "Migrating cache from format" << QString::fromStdString(migration.from)
+                        << "to" << QString::fromStdString(migration.to);
+
+                try {
+                        retryOnMapFull([this, &migration]() {
+                                auto lock = lockTxn();
+                                auto txn  = lmdb::txn::begin(env_);
+
+                                (this->*migration.run)(txn);
+
+                                lmdb::dbi_put(txn,
+                                              syncStateDb_,
+                                              CACHE_FORMAT_VERSION_KEY,
+                                              lmdb::val(migration.to.data(), migration.to.size()));
+
+                                txn.commit();
+                        });
+                } catch (const lmdb::error &e) {
+                        qCritical() << "cache migration failed:" << e.what();
+                        return;
+                } catch (const json::exception &e) {
+                        qCritical() << "cache migration failed:" << e.what();
+                        return;
+                }
+
+                emit migrationProgress(i + 1, total);
+        }
+
+        // Read the migrated records on the next lookup.
+        roomTable_.clear();
+}
+
+void
+Cache::migrateToBinaryRecords(lmdb::txn &txn)
+{
+        migrateRecords<RoomInfo>(txn, roomsDb_);
+        migrateRecords<RoomInfo>(txn, invitesDb_);
+
+        // The names of the per room databases are kept in the main database.
+        std::vector<std::string> membersdbs;
+
+        auto maindb = lmdb::dbi::open(txn, nullptr);
+        auto cursor = lmdb::cursor::open(txn, maindb);
+
+        std::string name, unused;
+        while (cursor.get(name, unused, MDB_NEXT)) {
+                const auto qname = QString::fromStdString(name);
+
+                if (qname.endsWith("/members") || qname.endsWith("/invite_members"))
+                        membersdbs.emplace_back(std::move(name));
+        }
+
+        cursor.close();
+
+        for (const auto &db : membersdbs) {
+                auto membersdb = lmdb::dbi::open(txn, db.c_str());
+                migrateRecords<MemberInfo>(txn, membersdb);
+        }
+}
+
+void
+Cache::migrateToSharedTables(lmdb::txn &txn)
+{
+        // Suffix of the per room database -> (shared table, whether it holds state events).
+        const std::vector<std::tuple<QString, lmdb::dbi *, bool>> tables = {
+          std::make_tuple("/state", &roomStateDb_, true),
+          std::make_tuple("/members", &roomMembersDb_, false),
+          std::make_tuple("/invite_state", &inviteStateDb_, true),
+          std::make_tuple("/invite_members", &inviteMembersDb_, false),
+          std::make_tuple("/messages", &roomMessagesDb_, false),
+        };
+
+        std::vector<std::string> names;
+
+        auto maindb = lmdb::dbi::open(txn, nullptr);
+        auto cursor = lmdb::cursor::open(txn, maindb);
+
+        std::string name, unused;
+        while (cursor.get(name, unused, MDB_NEXT)) {
+                if (name.find('/') != std::string::npos)
+                        names.emplace_back(std::move(name));
+        }
+
+        cursor.close();
+
+        for (const auto &db_name : names) {
+                const auto qname = QString::fromStdString(db_name);
+
+                for (const auto &table : tables) {
+                        const auto &suffix = std::get<0>(table);
+                        if (!qname.endsWith(suffix))
+                                continue;
+
+                        const auto room_id =
+                          qname.left(qname.size() - suffix.size()).toStdString();
+                        const auto prefix = room_id + '\0';
+
+                        auto db          = lmdb::dbi::open(txn, db_name.c_str());
+                        auto &shared     = *std::get<1>(table);
+                        auto room_cursor = lmdb::cursor::open(txn, db);
+
+                        lmdb::val key, value;
+                        while (room_cursor.get(key, value, MDB_NEXT)) {
+                                std::string new_key;
+
+                                if (std::get<2>(table)) {
+                                        const auto state_key =
+                                          parseValue(value).value("state_key", "");
+
+                                        new_key = stateKey(room_id,
+                                                           std::string(key.data(), key.size()),
+                                                           state_key);
+                                } else {
+                                        new_key = prefix + std::string(key.data(), key.size());
+                                }
+
+                                lmdb::dbi_put(txn, shared, lmdb::val(new_key), value);
+                        }
+
+                        room_cursor.close();
+
+                        lmdb::dbi_drop(txn, db, true);
+                        break;
+                }
+        }
+}
+
+void
+Cache::migrateToSearchIndex(lmdb::txn &txn)
+{
+        auto cursor = lmdb::cursor::open(txn, roomMessagesDb_);
+
+        lmdb::val key, value;
+        while (cursor.get(key, value, MDB_NEXT)) {
+                const std::string id(key.data(), key.size());
+                const auto room_id = id.substr(0, id.find('\0'));
+
+                try {
+                        search_.add(txn, room_id, parseValue(value).at("event"));
+                } catch (const json::exception &e) {
+                        qWarning() << "failed to parse timeline event:" << e.what();
+                }
+        }
+
+        cursor.close();
+}
+
+void
+Cache::migrateReadReceipts(lmdb::txn &txn)
+{
+        std::map<std::string, Receipts> receipts;
+
+        auto cursor = lmdb::cursor::open(txn, readReceiptsDb_);
+
+        lmdb::val key, value;
+        while (cursor.get(key, value, MDB_NEXT)) {
+                ReadReceiptKey receipt_key = parseValue(key);
+
+                receipts[receipt_key.room_id][receipt_key.event_id] =
+                  parseValue(value).get<std::map<std::string, uint64_t>>();
+        }
+
+        cursor.close();
+
+        lmdb::dbi_drop(txn, readReceiptsDb_, false);
+
+        for (const auto &room : receipts)
+                updateReadReceipt(txn, room.first, room.second);
+}
+
+void
+Cache::setCurrentFormat()
+{
+        if (writer_.isNull())
+                return;
+
+        auto saved = writer_->enqueue([this](lmdb::txn &txn) {
+                lmdb::dbi_put(txn,
+                              syncStateDb_,
+                              CACHE_FORMAT_VERSION_KEY,
+                              lmdb::val(CURRENT_CACHE_FORMAT_VERSION.data(),
+                                        CURRENT_CACHE_FORMAT_VERSION.size()));
+        });
+
+        saved.get();
+}
+
+CachedReceipts
+Cache::readReceipts(const QString &event_id, const QString &room_id)
+{
+        CachedReceipts receipts;
+
+        const auto prefix = receiptKey(room_id.toStdString(), event_id.toStdString(), "");
+
+        try {
+                auto snapshot = readSnapshot();
+                auto &txn     = snapshot.txn();
+                auto cursor   = lmdb::cursor::open(txn, readReceiptsDb_);
+
+                lmdb::val key(prefix), value;
+                bool found = cursor.get(key, value, MDB_SET_RANGE);
+
+                while (found && hasPrefix(key, prefix)) {
+                        // timestamp, user_id
+                        receipts.emplace(decodeKeyUint64BE(value.data(), value.size()),
+                                         std::string(key.data() + prefix.size(),
+                                                     key.size() - prefix.size()));
+
+                        found = cursor.get(key, value, MDB_NEXT);
+                }
+
+                cursor.close();
+        } catch (const lmdb::error &e) {
+                qCritical() << "readReceipts:" << e.what();
+        }
+
+        return receipts;
+}
+
+void
+Cache::updateReadReceipt(lmdb::txn &txn, const std::string &room_id, const Receipts &receipts)
+{
+        for (const auto &receipt : receipts) {
+                const auto event_id = receipt.first;
+
+                for (const auto &user_receipt : receipt.second) {
+                        const auto user_id   = user_receipt.first;
+                        const auto timestamp = user_receipt.second;
+                        const auto index_key = room_id + '\0' + user_id;
+
+                        try {
+                                lmdb::val prev_event, prev_timestamp;
+                                std::string prev_key;
+
+                                if (lmdb::dbi_get(
+                                      txn, latestReceiptsDb_, lmdb::val(index_key), prev_event))
+                                        prev_key = receiptKey(
+                                          room_id,
+                                          std::string(prev_event.data(), prev_event.size()),
+                                          user_id);
+
+                                // Only the latest receipt of a user is kept, so the one
+                                // on the previous event is replaced.
+                                if (!prev_key.empty() &&
+                                    lmdb::dbi_get(
+                                      txn, readReceiptsDb_, lmdb::val(prev_key), prev_timestamp)) {
+                                        // Ignore receipts older than the saved one.
+                                        if (decodeKeyUint64BE(prev_timestamp.data(),
+                                                         prev_timestamp.size()) > timestamp)
+                                                continue;
+
+                                        lmdb::dbi_del(
+                                          txn, readReceiptsDb_, lmdb::val(prev_key), nullptr);
+                                }
+
+                                lmdb::dbi_put(txn,
+                                              readReceiptsDb_,
+                                              lmdb::val(receiptKey(room_id, event_id, user_id)),
+                                              lmdb::val(encodeKeyUint64BE(timestamp)));
+                                lmdb::dbi_put(txn,
+                                              latestReceiptsDb_,
+                                              lmdb::val(index_key),
+                                              lmdb::val(event_id));
+                        } catch (const lmdb::error &e) {
+                                qCritical() << "updateReadReceipts:" << e.what();
+                        }
+                }
+        }
+}
+
+void
+Cache::removeReadReceipts(lmdb::txn &txn, const std::string &room_id)
+{
+        const auto prefix = room_id + '\0';
+
+        deletePrefix(txn, readReceiptsDb_, prefix);
+        deletePrefix(txn, latestReceiptsDb_, prefix);
+}
+
+void
+Cache::saveState(const mtx::responses::Sync &res)
+{
+        if (writer_.isNull())
+                return;
+
+        // Make the member changes of the sync visible to the UI once they are saved.
+        auto saved = writer_->enqueue([this, &res](lmdb::txn &txn) { saveState(txn, res); },
+                                      []() { Members.commit(); });
+
+        // Rethrows the error of the failed write.
+        saved.get();
+}
+
+void
+Cache::saveState(lmdb::txn &txn, const mtx::responses::Sync &res)
+{
+        // The token is committed along with the state it covers, so when the
+        // unsynced commits are lost in a crash the next sync resumes from the
+        // last state that made it to disk.
+        setNextBatchToken(txn, res.next_batch);
+
+        // Save joined rooms
+        for (const auto &room : res.rooms.join) {
+                const auto &state    = room.second.state.events;
+                const auto &timeline = room.second.timeline.events;
+
+                const auto members_delta = saveStateEvents(txn, room.first, state) +
+                                           saveStateEvents(txn, room.first, timeline);
+
+                // The room info only changes with the state events that are used to
+                // calculate it, so rooms with only new messages are left untouched.
+                lmdb::val unused;
+                if (hasStateUpdates(state) || hasStateUpdates(timeline) ||
+                    !lmdb::dbi_get(txn, roomsDb_, lmdb::val(room.first), unused))
+                        updateRoomInfo(txn, room.first, members_delta);
+
+                updateReadReceipt(txn, room.first, room.second.ephemeral.receipts);
+
+                saveTimelineMessages(txn, room.first, room.second.timeline);
+
+                // Clean up non-valid invites.
+                removeInvite(txn, room.first);
+        }
+
+        saveInvites(txn, res.rooms.invite);
+
+        removeLeftRooms(txn, res.rooms.leave);
+}
+
+void
+Cache::saveTimelineMessages(lmdb::txn &txn,
+                            const std::string &room_id,
+                            const mtx::responses::Timeline &timeline)
+{
+        const auto prefix = room_id + '\0';
+
+        // There is a gap between the saved events and the new ones,
+        // so we only keep the latest batch.
+        if (timeline.limited)
+                deletePrefix(txn, roomMessagesDb_, prefix);
+
+        uint64_t index = 0;
+
+        // Find the sequence number of the latest event.
+        {
+                auto cursor = lmdb::cursor::open(txn, roomMessagesDb_);
+
+                const auto upper = prefix + encodeKeyUint64BE(UINT64_MAX);
+
+                lmdb::val key(upper), value;
+                bool found = cursor.get(key, value, MDB_SET_RANGE)
+                               ? cursor.get(key, value, MDB_PREV)
+                               : cursor.get(key, value, MDB_LAST);
+
+                if (found && hasPrefix(key, prefix))
+                        index = decodeKeyUint64BE(key.data() + prefix.size(),
+                                             key.size() - prefix.size()) +
+                                1;
+
+                cursor.close();
+        }
+
+        for (const auto &e : timeline.events) {
+                if (!isTimelineMessage(e))
+                        continue;
+
+                json obj;
+                obj["event"] = mpark::visit([](const auto &msg) { return json(msg); }, e);
+                obj["token"] = timeline.prev_batch;
 
-        lmdb::val current_version;
-        bool res = lmdb::dbi_get(txn, syncStateDb_, CACHE_FORMAT_VERSION_KEY, current_version);
+                lmdb::dbi_put(txn,
+                              roomMessagesDb_,
+                              lmdb::val(prefix + encodeKeyUint64BE(index++)),
+                              lmdb::val(obj.dump()));
 
-        txn.commit();
+                // The index outlives the expired events.
+                search_.add(txn, room_id, obj["event"]);
+        }
 
-        if (!res)
-                return false;
+        // Drop the oldest batches. A token only points before the oldest event
+        // of its batch, so the batches are dropped whole & the newest is kept.
+        auto total = countWithPrefix(txn, roomMessagesDb_, prefix);
+        if (total <= MAX_STORED_MESSAGES)
+                return;
 
-        std::string stored_version(current_version.data(), current_version.size());
+        std::vector<std::string> expired;
+        std::string batch;
+        bool isFirst = true;
 
-        if (stored_version != CURRENT_CACHE_FORMAT_VERSION) {
-                qWarning() << "Stored format version" << QString::fromStdString(stored_version);
-                qWarning() << "There are breaking changes in the cache format.";
-                return false;
-        }
+        forEachWithPrefix(
+          txn, roomMessagesDb_, prefix, [&](const lmdb::val &suffix, const lmdb::val &value) {
+                  const auto token = timelineToken(value);
 
-        return true;
-}
+                  if (isFirst || token != batch) {
+                          if (total <= MAX_STORED_MESSAGES || token == timeline.prev_batch)
+                                  return false;
 
-void
-Cache::setCurrentFormat()
-{
-        auto txn = lmdb::txn::begin(env_);
+                          batch   = token;
+                          isFirst = false;
+                  }
 
-        lmdb::dbi_put(
-          txn,
-          syncStateDb_,
-          CACHE_FORMAT_VERSION_KEY,
-          lmdb::val(CURRENT_CACHE_FORMAT_VERSION.data(), CURRENT_CACHE_FORMAT_VERSION.size()));
+                  expired.emplace_back(prefix + std::string(suffix.data(), suffix.size()));
+                  total--;
 
-        txn.commit();
+                  return true;
+          });
+
+        for (const auto &key : expired)
+                lmdb::dbi_del(txn, roomMessagesDb_, lmdb::val(key), nullptr);
 }
 
-CachedReceipts
-Cache::readReceipts(const QString &event_id, const QString &room_id)
+mtx::responses::Timeline
+Cache::getTimelineMessages(lmdb::txn &txn, const std::string &room_id)
 {
-        CachedReceipts receipts;
+        const auto prefix = room_id + '\0';
 
-        ReadReceiptKey receipt_key{event_id.toStdString(), room_id.toStdString()};
-        nlohmann::json json_key = receipt_key;
+        std::string prev_batch;
+        std::vector<json> events;
 
-        try {
-                auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-                auto key = json_key.dump();
+        auto cursor = lmdb::cursor::open(txn, roomMessagesDb_);
 
-                lmdb::val value;
+        // Start from the latest event of the room.
+        const auto upper = prefix + encodeKeyUint64BE(UINT64_MAX);
 
-                bool res =
-                  lmdb::dbi_get(txn, readReceiptsDb_, lmdb::val(key.data(), key.size()), value);
+        lmdb::val key(upper), value;
+        bool found = cursor.get(key, value, MDB_SET_RANGE) ? cursor.get(key, value, MDB_PREV)
+                                                           : cursor.get(key, value, MDB_LAST);
 
-                txn.commit();
+        while (found && hasPrefix(key, prefix)) {
+                try {
+                        auto obj   = parseValue(value);
+                        auto token = obj.at("token").get<std::string>();
 
-                if (res) {
-                        auto json_response = json::parse(std::string(value.data(), value.size()));
-                        auto values        = json_response.get<std::map<std::string, uint64_t>>();
+                        // Only whole batches are restored, so the token of the
+                        // oldest batch leads to the events right before it.
+                        if (events.size() >= MAX_RESTORED_MESSAGES && token != prev_batch)
+                                break;
 
-                        for (const auto &v : values)
-                                // timestamp, user_id
-                                receipts.emplace(v.second, v.first);
+                        prev_batch = std::move(token);
+                        events.emplace_back(std::move(obj.at("event")));
+                } catch (const json::exception &e) {
+                        qWarning() << "failed to parse timeline event:" << e.what();
                 }
 
-        } catch (const lmdb::error &e) {
-                qCritical() << "readReceipts:" << e.what();
+                found = cursor.get(key, value, MDB_PREV);
         }
 
-        return receipts;
+        cursor.close();
+
+        // The events were collected from the newest to the oldest.
+        std::reverse(events.begin(), events.end());
+
+        try {
+                json obj = {{"events", events}, {"prev_batch", prev_batch}, {"limited", false}};
+                return obj;
+        } catch (const json::exception &e) {
+                qWarning() << "failed to restore timeline:" << QString::fromStdString(room_id)
+                           << e.what();
+        }
+
+        return mtx::responses::Timeline{};
 }
 
-void
-Cache::updateReadReceipt(lmdb::txn &txn, const std::string &room_id, const Receipts &receipts)
+std::map<QString, mtx::responses::Timeline>
+Cache::roomMessages()
 {
-        for (const auto &receipt : receipts) {
-                const auto event_id = receipt.first;
-                auto event_receipts = receipt.second;
-
-                ReadReceiptKey receipt_key{event_id, room_id};
-                nlohmann::json json_key = receipt_key;
+        std::map<QString, mtx::responses::Timeline> msgs;
 
-                try {
-                        const auto key = json_key.dump();
+        auto rooms    = joinedRooms();
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
 
-                        lmdb::val prev_value;
+        for (const auto &room_id : rooms)
+                msgs.emplace(QString::fromStdString(room_id), getTimelineMessages(txn, room_id));
 
-                        bool exists = lmdb::dbi_get(
-                          txn, readReceiptsDb_, lmdb::val(key.data(), key.size()), prev_value);
+        return msgs;
+}
 
-                        std::map<std::string, uint64_t> saved_receipts;
+std::vector<MessageSearchResult>
+Cache::searchMessages(const QString &query, const QString &room_id, std::size_t limit)
+{
+        try {
+                auto snapshot = readSnapshot();
 
-                        // If an entry for the event id already exists, we would
-                        // merge the existing receipts with the new ones.
-                        if (exists) {
-                                auto json_value =
-                                  json::parse(std::string(prev_value.data(), prev_value.size()));
+                return search_.search(snapshot.txn(), query, room_id.toStdString(), limit);
+        } catch (const lmdb::error &e) {
+                qWarning() << "message search failed:" << e.what();
+        }
 
-                                // Retrieve the saved receipts.
-                                saved_receipts = json_value.get<std::map<std::string, uint64_t>>();
-                        }
+        return {};
+}
 
-                        // Append the new ones.
-                        for (const auto &event_receipt : event_receipts)
-                                saved_receipts.emplace(event_receipt.first, event_receipt.second);
+std::map<QString, RoomListEntry>
+Cache::roomListEntries()
+{
+        std::map<QString, RoomListEntry> entries;
 
-                        // Save back the merged (or only the new) receipts.
-                        nlohmann::json json_updated_value = saved_receipts;
-                        std::string merged_receipts       = json_updated_value.dump();
+        try {
+                auto snapshot = readSnapshot();
+                auto cursor   = lmdb::cursor::open(snapshot.txn(), roomListDb_);
 
-                        lmdb::dbi_put(txn,
-                                      readReceiptsDb_,
-                                      lmdb::val(key.data(), key.size()),
-                                      lmdb::val(merged_receipts.data(), merged_receipts.size()));
+                lmdb::val room_id, data;
+                while (cursor.get(room_id, data, MDB_NEXT)) {
+                        RoomListEntry entry;
 
-                } catch (const lmdb::error &e) {
-                        qCritical() << "updateReadReceipts:" << e.what();
+                        if (record::decode(data, entry))
+                                entries.emplace(QString::fromUtf8(room_id.data(), room_id.size()),
+                                                std::move(entry));
                 }
+
+                cursor.close();
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to load the room list:" << e.what();
         }
+
+        return entries;
 }
 
 void
-Cache::saveState(const mtx::responses::Sync &res)
+Cache::saveLastMessage(const std::string &room_id, const RoomListEntry &message)
 {
-        auto txn = lmdb::txn::begin(env_);
-
-        setNextBatchToken(txn, res.next_batch);
-
-        // Save joined rooms
-        for (const auto &room : res.rooms.join) {
-                auto statesdb  = getStatesDb(txn, room.first);
-                auto membersdb = getMembersDb(txn, room.first);
+        updateRoomListEntry(room_id, [message](RoomListEntry &entry) {
+                entry.user_id   = message.user_id;
+                entry.username  = message.username;
+                entry.body      = message.body;
+                entry.timestamp = message.timestamp;
+        });
+}
 
-                saveStateEvents(txn, statesdb, membersdb, room.first, room.second.state.events);
-                saveStateEvents(txn, statesdb, membersdb, room.first, room.second.timeline.events);
+void
+Cache::saveUnreadCount(const std::string &room_id, uint64_t count)
+{
+        updateRoomListEntry(room_id, [count](RoomListEntry &entry) { entry.unread_count = count; });
+}
 
-                RoomInfo updatedInfo;
-                updatedInfo.name  = getRoomName(txn, statesdb, membersdb).toStdString();
-                updatedInfo.topic = getRoomTopic(txn, statesdb).toStdString();
-                updatedInfo.avatar_url =
-                  getRoomAvatarUrl(txn, statesdb, membersdb, QString::fromStdString(room.first))
-                    .toStdString();
+void
+Cache::updateRoomListEntry(const std::string &room_id,
+                           std::function<void(RoomListEntry &)> update)
+{
+        if (writer_.isNull())
+                return;
 
-                lmdb::dbi_put(
-                  txn, roomsDb_, lmdb::val(room.first), lmdb::val(json(updatedInfo).dump()));
+        writer_->enqueue([this, room_id, update](lmdb::txn &txn) {
+                lmdb::val data;
 
-                updateReadReceipt(txn, room.first, room.second.ephemeral.receipts);
+                // The room might have been left in the meantime.
+                if (!lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id), data))
+                        return;
 
-                // Clean up non-valid invites.
-                removeInvite(txn, room.first);
-        }
+                RoomListEntry entry;
 
-        saveInvites(txn, res.rooms.invite);
+                if (lmdb::dbi_get(txn, roomListDb_, lmdb::val(room_id), data) &&
+                    !record::decode(data, entry))
+                        entry = RoomListEntry();
 
-        removeLeftRooms(txn, res.rooms.leave);
+                update(entry);
 
-        txn.commit();
+                lmdb::dbi_put(
+                  txn, roomListDb_, lmdb::val(room_id), lmdb::val(record::encode(entry)));
+        });
 }
 
 void
 Cache::saveInvites(lmdb::txn &txn, const std::map<std::string, mtx::responses::InvitedRoom> &rooms)
 {
         for (const auto &room : rooms) {
-                auto statesdb  = getInviteStatesDb(txn, room.first);
-                auto membersdb = getInviteMembersDb(txn, room.first);
-
-                saveInvite(txn, statesdb, membersdb, room.second);
+                saveInvite(txn, room.first, room.second);
 
                 RoomInfo updatedInfo;
-                updatedInfo.name  = getInviteRoomName(txn, statesdb, membersdb).toStdString();
-                updatedInfo.topic = getInviteRoomTopic(txn, statesdb).toStdString();
-                updatedInfo.avatar_url =
-                  getInviteRoomAvatarUrl(txn, statesdb, membersdb).toStdString();
-                updatedInfo.is_invite = true;
+                updatedInfo.name       = getInviteRoomName(txn, room.first).toStdString();
+                updatedInfo.topic      = getInviteRoomTopic(txn, room.first).toStdString();
+                updatedInfo.avatar_url = getInviteRoomAvatarUrl(txn, room.first).toStdString();
+                updatedInfo.is_invite  = true;
 
                 lmdb::dbi_put(
-                  txn, invitesDb_, lmdb::val(room.first), lmdb::val(json(updatedInfo).dump()));
+                  txn, invitesDb_, lmdb::val(room.first), lmdb::val(record::encode(updatedInfo)));
+                roomTable_.putInvite(QString::fromStdString(room.first), updatedInfo);
         }
 }
 
 void
 Cache::saveInvite(lmdb::txn &txn,
-                  lmdb::dbi &statesdb,
-                  lmdb::dbi &membersdb,
+                  const std::string &room_id,
                   const mtx::responses::InvitedRoom &room)
 {
         using namespace mtx::events;
@@ -448,19 +2251,24 @@ Cache::saveInvite(lmdb::txn &txn,
 
                         MemberInfo tmp{display_name, msg.content.avatar_url};
 
-                        lmdb::dbi_put(
-                          txn, membersdb, lmdb::val(msg.state_key), lmdb::val(json(tmp).dump()));
+                        lmdb::dbi_put(txn,
+                                      inviteMembersDb_,
+                                      lmdb::val(memberKey(room_id, msg.state_key)),
+                                      lmdb::val(record::encode(tmp)));
                 } else {
                         mpark::visit(
-                          [&txn, &statesdb](auto msg) {
+                          [this, &txn, &room_id](auto msg) {
+                                  const auto key =
+                                    stateKey(room_id, to_string(msg.type), msg.state_key);
+
                                   bool res = lmdb::dbi_put(txn,
-                                                           statesdb,
-                                                           lmdb::val(to_string(msg.type)),
+                                                           inviteStateDb_,
+                                                           lmdb::val(key),
                                                            lmdb::val(json(msg).dump()));
 
                                   if (!res)
-                                          std::cout << "couldn't save data" << json(msg).dump()
-                                                    << '\n';
+                                          qWarning() << "couldn't save invite state"
+                                                     << QString::fromStdString(key);
                           },
                           e);
                 }
@@ -472,32 +2280,14 @@ Cache::roomsWithStateUpdates(const mtx::responses::Sync &res)
 {
         std::vector<std::string> rooms;
         for (const auto &room : res.rooms.join) {
-                bool hasUpdates = false;
-                for (const auto &s : room.second.state.events) {
-                        if (containsStateUpdates(s)) {
-                                hasUpdates = true;
-                                break;
-                        }
-                }
-
-                for (const auto &s : room.second.timeline.events) {
-                        if (containsStateUpdates(s)) {
-                                hasUpdates = true;
-                                break;
-                        }
-                }
-
-                if (hasUpdates)
+                if (hasStateUpdates(room.second.state.events) ||
+                    hasStateUpdates(room.second.timeline.events))
                         rooms.emplace_back(room.first);
         }
 
         for (const auto &room : res.rooms.invite) {
-                for (const auto &s : room.second.invite_state) {
-                        if (containsStateUpdates(s)) {
-                                rooms.emplace_back(room.first);
-                                break;
-                        }
-                }
+                if (hasStateUpdates(room.second.invite_state))
+                        rooms.emplace_back(room.first);
         }
 
         return rooms;
@@ -508,75 +2298,56 @@ Cache::getRoomInfo(const std::vector<std::string> &rooms)
 {
         std::map<QString, RoomInfo> room_info;
 
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        for (const auto &room : rooms) {
+                const auto room_id = QString::fromStdString(room);
+
+                RoomInfo info;
+                if (roomTable_.find(room_id, info))
+                        room_info.emplace(room_id, std::move(info));
+        }
+
+        return room_info;
+}
+
+std::map<QString, RoomInfo>
+Cache::getRoomInfo(lmdb::txn &txn, const std::vector<std::string> &rooms)
+{
+        std::map<QString, RoomInfo> room_info;
 
         for (const auto &room : rooms) {
                 lmdb::val data;
 
                 // Check if the room is joined.
                 if (lmdb::dbi_get(txn, roomsDb_, lmdb::val(room), data)) {
-                        try {
-                                room_info.emplace(
-                                  QString::fromStdString(room),
-                                  json::parse(std::string(data.data(), data.size())));
-                        } catch (const json::exception &e) {
+                        RoomInfo info;
+
+                        if (record::decode(data, info))
+                                room_info.emplace(QString::fromStdString(room), std::move(info));
+                        else
                                 qWarning()
-                                  << "failed to parse room info:" << QString::fromStdString(room)
-                                  << QString::fromStdString(std::string(data.data(), data.size()));
-                        }
+                                  << "failed to decode room info:" << QString::fromStdString(room);
                 } else {
                         // Check if the room is an invite.
                         if (lmdb::dbi_get(txn, invitesDb_, lmdb::val(room), data)) {
-                                try {
-                                        room_info.emplace(
-                                          QString::fromStdString(room),
-                                          json::parse(std::string(data.data(), data.size())));
-                                } catch (const json::exception &e) {
-                                        qWarning() << "failed to parse room info for invite:"
-                                                   << QString::fromStdString(room)
-                                                   << QString::fromStdString(
-                                                        std::string(data.data(), data.size()));
-                                }
+                                RoomInfo info;
+
+                                if (record::decode(data, info))
+                                        room_info.emplace(QString::fromStdString(room),
+                                                          std::move(info));
+                                else
+                                        qWarning() << "failed to decode room info for invite:"
+                                                   << QString::fromStdString(room);
                         }
                 }
         }
 
-        txn.commit();
-
         return room_info;
 }
 
 QMap<QString, RoomInfo>
 Cache::roomInfo(bool withInvites)
 {
-        QMap<QString, RoomInfo> result;
-
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-
-        std::string room_id;
-        std::string room_data;
-
-        // Gather info about the joined rooms.
-        auto roomsCursor = lmdb::cursor::open(txn, roomsDb_);
-        while (roomsCursor.get(room_id, room_data, MDB_NEXT)) {
-                RoomInfo tmp = json::parse(std::move(room_data));
-                result.insert(QString::fromStdString(std::move(room_id)), std::move(tmp));
-        }
-        roomsCursor.close();
-
-        if (withInvites) {
-                // Gather info about the invites.
-                auto invitesCursor = lmdb::cursor::open(txn, invitesDb_);
-                while (invitesCursor.get(room_id, room_data, MDB_NEXT)) {
-                        RoomInfo tmp = json::parse(room_data);
-                        result.insert(QString::fromStdString(std::move(room_id)), std::move(tmp));
-                }
-                invitesCursor.close();
-        }
-
-        txn.commit();
-
-        return result;
+        return withInvites ? roomTable_.all() : roomTable_.joined();
 }
 
 std::map<QString, bool>
@@ -584,8 +2355,9 @@ Cache::invites()
 {
         std::map<QString, bool> result;
 
-        auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        auto cursor = lmdb::cursor::open(txn, invitesDb_);
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
+        auto cursor   = lmdb::cursor::open(txn, invitesDb_);
 
         std::string room_id, unused;
 
@@ -593,29 +2365,28 @@ Cache::invites()
                 result.emplace(QString::fromStdString(std::move(room_id)), true);
 
         cursor.close();
-        txn.commit();
 
         return result;
 }
 
 QString
-Cache::getRoomAvatarUrl(lmdb::txn &txn,
-                        lmdb::dbi &statesdb,
-                        lmdb::dbi &membersdb,
-                        const QString &room_id)
+Cache::getRoomAvatarUrl(lmdb::txn &txn, const std::string &room_id, RoomSummary &summary)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
 
         lmdb::val event;
         bool res = lmdb::dbi_get(
-          txn, statesdb, lmdb::val(to_string(mtx::events::EventType::RoomAvatar)), event);
+          txn,
+          roomStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomAvatar), "")),
+          event);
 
         if (res) {
                 try {
-                        StateEvent<Avatar> msg =
-                          json::parse(std::string(event.data(), event.size()));
+                        StateEvent<Avatar> msg = parseValue(event);
 
+                        summary.avatar_source = RoomSummary::AvatarSource::Room;
                         return QString::fromStdString(msg.content.url);
                 } catch (const json::exception &e) {
                         qWarning() << QString::fromStdString(e.what());
@@ -623,124 +2394,167 @@ Cache::getRoomAvatarUrl(lmdb::txn &txn,
         }
 
         // We don't use an avatar for group chats.
-        if (membersdb.size(txn) > 2)
+        if (summary.member_count > 2) {
+                summary.avatar_source = RoomSummary::AvatarSource::None;
                 return QString();
+        }
 
-        auto cursor = lmdb::cursor::open(txn, membersdb);
-        std::string user_id;
-        std::string member_data;
-
-        // Resolve avatar for 1-1 chats.
-        while (cursor.get(user_id, member_data, MDB_NEXT)) {
-                if (user_id == localUserId_.toStdString())
-                        continue;
-
-                try {
-                        MemberInfo m = json::parse(member_data);
+        summary.avatar_source = RoomSummary::AvatarSource::Member;
 
-                        cursor.close();
-                        return QString::fromStdString(m.avatar_url);
-                } catch (const json::exception &e) {
-                        qWarning() << QString::fromStdString(e.what());
-                }
-        }
+        // Resolve avatar for 1-1 chats. The only member is the local user.
+        const auto member =
+          summary.heroes.empty() ? localUserId_.toStdString() : summary.heroes.front();
 
-        cursor.close();
+        // Read with the write transaction instead of the member directory, which
+        // would open its own read transaction on the writer thread.
+        lmdb::val data;
+        MemberInfo m;
+        if (lmdb::dbi_get(txn, roomMembersDb_, lmdb::val(memberKey(room_id, member)), data) &&
+            record::decode(data, m))
+                return QString::fromStdString(m.avatar_url);
 
-        // Default case when there is only one member.
-        return avatarUrl(room_id, localUserId_);
+        return QString();
 }
 
 QString
-Cache::getRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getRoomName(lmdb::txn &txn, const std::string &room_id, RoomSummary &summary)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
 
         lmdb::val event;
         bool res = lmdb::dbi_get(
-          txn, statesdb, lmdb::val(to_string(mtx::events::EventType::RoomName)), event);
+          txn,
+          roomStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomName), "")),
+          event);
 
         if (res) {
                 try {
-                        StateEvent<Name> msg = json::parse(std::string(event.data(), event.size()));
+                        StateEvent<Name> msg = parseValue(event);
 
-                        if (!msg.content.name.empty())
+                        if (!msg.content.name.empty()) {
+                                summary.name_source = RoomSummary::NameSource::Name;
                                 return QString::fromStdString(msg.content.name);
+                        }
                 } catch (const json::exception &e) {
                         qWarning() << QString::fromStdString(e.what());
                 }
         }
 
         res = lmdb::dbi_get(
-          txn, statesdb, lmdb::val(to_string(mtx::events::EventType::RoomCanonicalAlias)), event);
+          txn,
+          roomStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomCanonicalAlias), "")),
+          event);
 
         if (res) {
                 try {
-                        StateEvent<CanonicalAlias> msg =
-                          json::parse(std::string(event.data(), event.size()));
+                        StateEvent<CanonicalAlias> msg = parseValue(event);
 
-                        if (!msg.content.alias.empty())
+                        if (!msg.content.alias.empty()) {
+                                summary.name_source = RoomSummary::NameSource::CanonicalAlias;
                                 return QString::fromStdString(msg.content.alias);
+                        }
                 } catch (const json::exception &e) {
                         qWarning() << QString::fromStdString(e.what());
                 }
         }
 
-        auto cursor     = lmdb::cursor::open(txn, membersdb);
-        const int total = membersdb.size(txn);
+        summary.name_source = RoomSummary::NameSource::Members;
 
-        std::size_t ii = 0;
-        std::string user_id;
-        std::string member_data;
-        std::map<std::string, MemberInfo> members;
+        const auto total = summary.member_count;
+        if (total == 0)
+                return "Empty Room";
 
-        while (cursor.get(user_id, member_data, MDB_NEXT) && ii < 3) {
-                try {
-                        members.emplace(user_id, json::parse(member_data));
-                } catch (const json::exception &e) {
-                        qWarning() << QString::fromStdString(e.what());
-                }
+        // The local user is the only member when there are no heroes.
+        const auto first_id = summary.heroes.empty() ? localUserId_.toStdString()
+                                                     : summary.heroes.front();
+
+        auto first_member = QString::fromStdString(first_id);
+
+        lmdb::val data;
+        MemberInfo m;
+        if (lmdb::dbi_get(txn, roomMembersDb_, lmdb::val(memberKey(room_id, first_id)), data) &&
+            record::decode(data, m))
+                first_member = QString::fromStdString(m.name);
+
+        if (total > 2)
+                return QString("%1 and %2 others").arg(first_member).arg(total);
+
+        return first_member;
+}
+
+RoomSummary
+Cache::getRoomSummary(lmdb::txn &txn, const std::string &room_id)
+{
+        RoomSummary summary;
+
+        lmdb::val data;
+        if (lmdb::dbi_get(txn, roomSummariesDb_, lmdb::val(room_id), data) &&
+            record::decode(data, summary))
+                return summary;
+
+        summary.member_count = countWithPrefix(txn, roomMembersDb_, room_id + '\0');
+
+        return summary;
+}
+
+void
+Cache::updateRoomInfo(lmdb::txn &txn, const std::string &room_id, int64_t members_delta)
+{
+        lmdb::val data;
+        const bool hasSummary = lmdb::dbi_get(txn, roomSummariesDb_, lmdb::val(room_id), data);
 
-                ii++;
+        auto summary = getRoomSummary(txn, room_id);
+
+        // A calculated summary already includes the saved members.
+        if (hasSummary) {
+                const auto count     = static_cast<int64_t>(summary.member_count) + members_delta;
+                summary.member_count = count > 0 ? count : 0;
         }
 
-        cursor.close();
+        // Only the first few members are needed to name the room.
+        const auto local_user = localUserId_.toStdString();
 
-        if (total == 1 && !members.empty())
-                return QString::fromStdString(members.begin()->second.name);
+        summary.heroes.clear();
+        forEachWithPrefix(
+          txn, roomMembersDb_, room_id + '\0', [&](const lmdb::val &user_id, const lmdb::val &) {
+                  std::string id(user_id.data(), user_id.size());
 
-        auto first_member = [&members, this]() {
-                for (const auto &m : members) {
-                        if (m.first != localUserId_.toStdString())
-                                return QString::fromStdString(m.second.name);
-                }
+                  if (id != local_user)
+                          summary.heroes.emplace_back(std::move(id));
 
-                return localUserId_;
-        }();
+                  return summary.heroes.size() < MAX_ROOM_HEROES;
+          });
 
-        if (total == 2)
-                return first_member;
-        else if (total > 2)
-                return QString("%1 and %2 others").arg(first_member).arg(total);
+        RoomInfo updatedInfo;
+        updatedInfo.name       = getRoomName(txn, room_id, summary).toStdString();
+        updatedInfo.topic      = getRoomTopic(txn, room_id).toStdString();
+        updatedInfo.avatar_url = getRoomAvatarUrl(txn, room_id, summary).toStdString();
 
-        return "Empty Room";
+        lmdb::dbi_put(
+          txn, roomSummariesDb_, lmdb::val(room_id), lmdb::val(record::encode(summary)));
+        lmdb::dbi_put(txn, roomsDb_, lmdb::val(room_id), lmdb::val(record::encode(updatedInfo)));
+        roomTable_.putRoom(QString::fromStdString(room_id), updatedInfo);
 }
 
 QString
-Cache::getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb)
+Cache::getRoomTopic(lmdb::txn &txn, const std::string &room_id)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
 
         lmdb::val event;
         bool res = lmdb::dbi_get(
-          txn, statesdb, lmdb::val(to_string(mtx::events::EventType::RoomTopic)), event);
+          txn,
+          roomStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomTopic), "")),
+          event);
 
         if (res) {
                 try {
-                        StateEvent<Topic> msg =
-                          json::parse(std::string(event.data(), event.size()));
+                        StateEvent<Topic> msg = parseValue(event);
 
                         if (!msg.content.topic.empty())
                                 return QString::fromStdString(msg.content.topic);
@@ -753,103 +2567,117 @@ Cache::getRoomTopic(lmdb::txn &txn, lmdb::dbi &statesdb)
 }
 
 QString
-Cache::getInviteRoomName(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getInviteRoomName(lmdb::txn &txn, const std::string &room_id)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
 
         lmdb::val event;
         bool res = lmdb::dbi_get(
-          txn, statesdb, lmdb::val(to_string(mtx::events::EventType::RoomName)), event);
+          txn,
+          inviteStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomName), "")),
+          event);
 
         if (res) {
                 try {
-                        StrippedEvent<state::Name> msg =
-                          json::parse(std::string(event.data(), event.size()));
+                        StrippedEvent<state::Name> msg = parseValue(event);
                         return QString::fromStdString(msg.content.name);
                 } catch (const json::exception &e) {
                         qWarning() << QString::fromStdString(e.what());
                 }
         }
 
-        auto cursor = lmdb::cursor::open(txn, membersdb);
-        std::string user_id, member_data;
+        const auto local_user = localUserId_.toStdString();
 
-        while (cursor.get(user_id, member_data, MDB_NEXT)) {
-                if (user_id == localUserId_.toStdString())
-                        continue;
+        QString result("Empty Room");
 
-                try {
-                        MemberInfo tmp = json::parse(member_data);
-                        cursor.close();
+        forEachWithPrefix(txn,
+                          inviteMembersDb_,
+                          room_id + '\0',
+                          [&](const lmdb::val &user_id, const lmdb::val &data) {
+                                  if (user_id.size() == local_user.size() &&
+                                      std::equal(
+                                        local_user.begin(), local_user.end(), user_id.data()))
+                                          return true;
 
-                        return QString::fromStdString(tmp.name);
-                } catch (const json::exception &e) {
-                        qWarning() << QString::fromStdString(e.what());
-                }
-        }
+                                  MemberInfo tmp;
+                                  if (!record::decode(data, tmp)) {
+                                          qWarning() << "failed to decode member info";
+                                          return true;
+                                  }
 
-        cursor.close();
+                                  result = QString::fromStdString(tmp.name);
+                                  return false;
+                          });
 
-        return QString("Empty Room");
+        return result;
 }
 
 QString
-Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, lmdb::dbi &statesdb, lmdb::dbi &membersdb)
+Cache::getInviteRoomAvatarUrl(lmdb::txn &txn, const std::string &room_id)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
 
         lmdb::val event;
         bool res = lmdb::dbi_get(
-          txn, statesdb, lmdb::val(to_string(mtx::events::EventType::RoomAvatar)), event);
+          txn,
+          inviteStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomAvatar), "")),
+          event);
 
         if (res) {
                 try {
-                        StrippedEvent<state::Avatar> msg =
-                          json::parse(std::string(event.data(), event.size()));
+                        StrippedEvent<state::Avatar> msg = parseValue(event);
                         return QString::fromStdString(msg.content.url);
                 } catch (const json::exception &e) {
                         qWarning() << QString::fromStdString(e.what());
                 }
         }
 
-        auto cursor = lmdb::cursor::open(txn, membersdb);
-        std::string user_id, member_data;
+        const auto local_user = localUserId_.toStdString();
 
-        while (cursor.get(user_id, member_data, MDB_NEXT)) {
-                if (user_id == localUserId_.toStdString())
-                        continue;
+        QString result;
 
-                try {
-                        MemberInfo tmp = json::parse(member_data);
-                        cursor.close();
+        forEachWithPrefix(txn,
+                          inviteMembersDb_,
+                          room_id + '\0',
+                          [&](const lmdb::val &user_id, const lmdb::val &data) {
+                                  if (user_id.size() == local_user.size() &&
+                                      std::equal(
+                                        local_user.begin(), local_user.end(), user_id.data()))
+                                          return true;
 
-                        return QString::fromStdString(tmp.avatar_url);
-                } catch (const json::exception &e) {
-                        qWarning() << QString::fromStdString(e.what());
-                }
-        }
+                                  MemberInfo tmp;
+                                  if (!record::decode(data, tmp)) {
+                                          qWarning() << "failed to decode member info";
+                                          return true;
+                                  }
 
-        cursor.close();
+                                  result = QString::fromStdString(tmp.avatar_url);
+                                  return false;
+                          });
 
-        return QString();
+        return result;
 }
 
 QString
-Cache::getInviteRoomTopic(lmdb::txn &txn, lmdb::dbi &db)
+Cache::getInviteRoomTopic(lmdb::txn &txn, const std::string &room_id)
 {
         using namespace mtx::events;
         using namespace mtx::events::state;
 
         lmdb::val event;
-        bool res =
-          lmdb::dbi_get(txn, db, lmdb::val(to_string(mtx::events::EventType::RoomTopic)), event);
+        bool res = lmdb::dbi_get(
+          txn,
+          inviteStateDb_,
+          lmdb::val(stateKey(room_id, to_string(mtx::events::EventType::RoomTopic), "")),
+          event);
 
         if (res) {
                 try {
-                        StrippedEvent<Topic> msg =
-                          json::parse(std::string(event.data(), event.size()));
+                        StrippedEvent<Topic> msg = parseValue(event);
                         return QString::fromStdString(msg.content.topic);
                 } catch (const json::exception &e) {
                         qWarning() << QString::fromStdString(e.what());
@@ -862,44 +2690,32 @@ Cache::getInviteRoomTopic(lmdb::txn &txn, lmdb::dbi &db)
 QImage
 Cache::getRoomAvatar(const QString &room_id)
 {
-        auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-
-        lmdb::val response;
+        RoomInfo info;
 
-        if (!lmdb::dbi_get(txn, roomsDb_, lmdb::val(room_id.toStdString()), response)) {
-                txn.commit();
+        if (!roomTable_.find(room_id, info))
                 return QImage();
-        }
 
-        std::string media_url;
-
-        try {
-                RoomInfo info = json::parse(std::string(response.data(), response.size()));
-                media_url     = std::move(info.avatar_url);
-
-                if (media_url.empty()) {
-                        txn.commit();
-                        return QImage();
-                }
-        } catch (const json::exception &e) {
-                qWarning() << "failed to parse room info" << e.what()
-                           << QString::fromStdString(std::string(response.data(), response.size()));
-        }
+        return getRoomAvatar(info);
+}
 
-        if (!lmdb::dbi_get(txn, mediaDb_, lmdb::val(media_url), response)) {
-                txn.commit();
+QImage
+Cache::getRoomAvatar(const RoomInfo &info)
+{
+        if (info.avatar_url.empty())
                 return QImage();
-        }
 
-        txn.commit();
+        auto data = image(QString::fromStdString(info.avatar_url));
+        if (data.isEmpty())
+                return QImage();
 
-        return QImage::fromData(QByteArray(response.data(), response.size()));
+        return QImage::fromData(data);
 }
 
 std::vector<std::string>
 Cache::joinedRooms()
 {
-        auto txn         = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+        auto snapshot    = readSnapshot();
+        auto &txn        = snapshot.txn();
         auto roomsCursor = lmdb::cursor::open(txn, roomsDb_);
 
         std::string id, data;
@@ -910,39 +2726,38 @@ Cache::joinedRooms()
                 room_ids.emplace_back(id);
 
         roomsCursor.close();
-        txn.commit();
 
         return room_ids;
 }
 
-void
-Cache::populateMembers()
+bool
+Cache::loadMembers(const std::string &room_id, MemberDirectory::Members &members)
 {
-        auto rooms = joinedRooms();
-        qDebug() << "loading" << rooms.size() << "rooms";
-
-        auto txn = lmdb::txn::begin(env_);
-
-        for (const auto &room : rooms) {
-                const auto roomid = QString::fromStdString(room);
+        try {
+                auto snapshot = readSnapshot();
+                auto &txn     = snapshot.txn();
 
-                auto membersdb = getMembersDb(txn, room);
-                auto cursor    = lmdb::cursor::open(txn, membersdb);
+                auto load = [&members](const lmdb::val &user_id, const lmdb::val &info) {
+                        MemberInfo m;
+                        if (!record::decode(info, m))
+                                return true;
 
-                std::string user_id, info;
-                while (cursor.get(user_id, info, MDB_NEXT)) {
-                        MemberInfo m = json::parse(info);
+                        members.insert(QString::fromUtf8(user_id.data(), user_id.size()),
+                                       {QString::fromStdString(m.name),
+                                        QString::fromStdString(m.avatar_url)});
 
-                        const auto userid = QString::fromStdString(user_id);
+                        return true;
+                };
 
-                        insertDisplayName(roomid, userid, QString::fromStdString(m.name));
-                        insertAvatarUrl(roomid, userid, QString::fromStdString(m.avatar_url));
-                }
+                forEachWithPrefix(txn, roomMembersDb_, room_id + '\0', load);
 
-                cursor.close();
+                return true;
+        } catch (const lmdb::error &e) {
+                qWarning() << "failed to load members:" << QString::fromStdString(room_id)
+                           << e.what();
         }
 
-        txn.commit();
+        return false;
 }
 
 QVector<SearchResult>
@@ -952,16 +2767,26 @@ Cache::getAutocompleteMatches(const std::string &room_id,
 {
         std::multimap<int, std::pair<std::string, std::string>> items;
 
-        auto txn    = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
-        auto cursor = lmdb::cursor::open(txn, getMembersDb(txn, room_id));
+        auto snapshot = readSnapshot();
+        auto &txn     = snapshot.txn();
+
+        forEachWithPrefix(
+          txn,
+          roomMembersDb_,
+          room_id + '\0',
+          [&](const lmdb::val &user_id, const lmdb::val &user_data) {
+                  MemberInfo m;
+                  if (!record::decode(user_data, m))
+                          return true;
 
-        std::string user_id, user_data;
-        while (cursor.get(user_id, user_data, MDB_NEXT)) {
-                const auto display_name = displayName(room_id, user_id);
-                const int score         = utils::levenshtein_distance(query, display_name);
+                  const int score = utils::levenshtein_distance(query, m.name);
 
-                items.emplace(score, std::make_pair(user_id, display_name));
-        }
+                  items.emplace(score,
+                                std::make_pair(std::string(user_id.data(), user_id.size()),
+                                               std::move(m.name)));
+
+                  return true;
+          });
 
         auto end = items.begin();
 
@@ -980,65 +2805,13 @@ Cache::getAutocompleteMatches(const std::string &room_id,
         return results;
 }
 
-QHash<QString, QString> Cache::DisplayNames;
-QHash<QString, QString> Cache::AvatarUrls;
-
-QString
-Cache::displayName(const QString &room_id, const QString &user_id)
-{
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        if (DisplayNames.contains(fmt))
-                return DisplayNames[fmt];
-
-        return user_id;
-}
+MemberDirectory Cache::Members;
 
 std::string
 Cache::displayName(const std::string &room_id, const std::string &user_id)
 {
-        auto fmt = QString::fromStdString(room_id + " " + user_id);
-        if (DisplayNames.contains(fmt))
-                return DisplayNames[fmt].toStdString();
-
-        return user_id;
-}
-
-QString
-Cache::avatarUrl(const QString &room_id, const QString &user_id)
-{
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        if (AvatarUrls.contains(fmt))
-                return AvatarUrls[fmt];
-
-        return QString();
-}
-
-void
-Cache::insertDisplayName(const QString &room_id,
-                         const QString &user_id,
-                         const QString &display_name)
-{
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        DisplayNames.insert(fmt, display_name);
-}
-
-void
-Cache::removeDisplayName(const QString &room_id, const QString &user_id)
-{
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        DisplayNames.remove(fmt);
-}
-
-void
-Cache::insertAvatarUrl(const QString &room_id, const QString &user_id, const QString &avatar_url)
-{
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        AvatarUrls.insert(fmt, avatar_url);
-}
+        const auto name =
+          Members.displayName(QString::fromStdString(room_id), QString::fromStdString(user_id));
 
-void
-Cache::removeAvatarUrl(const QString &room_id, const QString &user_id)
-{
-        auto fmt = QString("%1 %2").arg(room_id).arg(user_id);
-        AvatarUrls.remove(fmt);
+        return name.toStdString();
 }
@@ -0,0 +1,159 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+
+#include "CacheWriter.h"
+
+//! Maximum number of writes committed in a single transaction.
+static constexpr std::size_t MAX_BATCH_SIZE = 64;
+
+CacheWriter::CacheWriter(Runner runner)
+  : runner_{std::move(runner)}
+{
+        thread_ = std::thread([this]() { run(); });
+}
+
+CacheWriter::~CacheWriter()
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+        }
+
+        cv_.notify_one();
+        thread_.join();
+}
+
+std::shared_future<void>
+CacheWriter::push(std::unique_ptr<Entry> entry)
+{
+        auto future = entry->done.get_future().share();
+
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back(std::move(entry));
+        }
+
+        cv_.notify_one();
+
+        return future;
+}
+
+std::shared_future<void>
+CacheWriter::enqueue(Write write, std::function<void()> onCommit)
+{
+        std::unique_ptr<Entry> entry(new Entry);
+        entry->write    = std::move(write);
+        entry->onCommit = std::move(onCommit);
+
+        return push(std::move(entry));
+}
+
+std::shared_future<void>
+CacheWriter::post(std::function<void()> task)
+{
+        std::unique_ptr<Entry> entry(new Entry);
+        entry->task = std::move(task);
+
+        return push(std::move(entry));
+}
+
+std::shared_future<void>
+CacheWriter::fence()
+{
+        // An empty entry is resolved once the preceding entries are processed.
+        return push(std::unique_ptr<Entry>(new Entry));
+}
+
+void
+CacheWriter::run()
+{
+        while (true) {
+                std::vector<std::unique_ptr<Entry>> batch;
+                std::unique_ptr<Entry> next;
+
+                {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+
+                        if (queue_.empty())
+                                return;
+
+                        // Take the consecutive writes, up to the next task or fence.
+                        while (!queue_.empty() && queue_.front()->write &&
+                               batch.size() < MAX_BATCH_SIZE) {
+                                batch.push_back(std::move(queue_.front()));
+                                queue_.pop_front();
+                        }
+
+                        if (batch.empty()) {
+                                next = std::move(queue_.front());
+                                queue_.pop_front();
+                        }
+                }
+
+                if (!batch.empty()) {
+                        commit(batch);
+                        continue;
+                }
+
+                try {
+                        if (next->task)
+                                next->task();
+
+                        next->done.set_value();
+                } catch (...) {
+                        next->done.set_exception(std::current_exception());
+                }
+        }
+}
+
+void
+CacheWriter::commit(std::vector<std::unique_ptr<Entry>> &batch)
+{
+        try {
+                runner_([&batch](lmdb::txn &txn) {
+                        for (const auto &entry : batch)
+                                entry->write(txn);
+                });
+        } catch (const std::exception &e) {
+                if (batch.size() == 1) {
+                        qCritical() << "cache write failed:" << e.what();
+                        batch.front()->done.set_exception(std::current_exception());
+                        return;
+                }
+
+                qWarning() << "cache batch of" << batch.size() << "writes failed:" << e.what();
+
+                for (auto &entry : batch) {
+                        std::vector<std::unique_ptr<Entry>> single;
+                        single.push_back(std::move(entry));
+
+                        commit(single);
+                }
+
+                return;
+        }
+
+        for (auto &entry : batch) {
+                if (entry->onCommit)
+                        entry->onCommit();
+
+                entry->done.set_value();
+        }
+}
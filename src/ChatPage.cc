@@ -37,11 +37,14 @@
 #include "UserInfoWidget.h"
 #include "UserSettingsPage.h"
 
+#include "dialogs/MessageSearch.h"
 #include "dialogs/ReadReceipts.h"
 #include "timeline/TimelineViewManager.h"
 
 constexpr int SYNC_RETRY_TIMEOUT         = 40 * 1000;
 constexpr int INITIAL_SYNC_RETRY_TIMEOUT = 240 * 1000;
+//! Delay before the sync restarts from the cache when a response couldn't be saved.
+constexpr int SYNC_RESTART_DELAY = 10 * 1000;
 
 ChatPage *ChatPage::instance_ = nullptr;
 
@@ -404,20 +407,63 @@ ChatPage::ChatPage(QSharedPointer<MatrixClient> client,
                 client_->sync();
         });
 
+        syncPipeline_.setMaxThreadCount(1);
+
+        connect(this, &ChatPage::syncProcessed, this, [this]() {
+                pendingSyncs_ = std::max(pendingSyncs_ - 1, 0);
+
+                if (!pausedBatchToken_.isEmpty() && !syncStopped_ && !syncFailed_) {
+                        emit continueSync(pausedBatchToken_);
+                        pausedBatchToken_.clear();
+                }
+        });
+
+        connect(this, &ChatPage::syncSaveFailed, this, [this]() {
+                // The running sync builds on the batch that wasn't saved.
+                syncTimeoutTimer_->stop();
+                client_->abortSync();
+                pausedBatchToken_.clear();
+
+                QTimer::singleShot(SYNC_RESTART_DELAY, this, [this]() {
+                        if (syncStopped_ || !syncFailed_)
+                                return;
+
+                        // Let the pipeline drop the responses queued after the failed one.
+                        syncPipeline_.waitForDone();
+                        syncFailed_ = false;
+
+                        try {
+                                const auto token = cache_->nextBatchToken();
+
+                                qInfo() << "restarting the sync from the saved token";
+                                emit continueSync(token);
+                        } catch (const lmdb::error &e) {
+                                qCritical() << "failed to read the sync token:" << e.what();
+                                syncFailed_ = true;
+                                emit syncSaveFailed();
+                        }
+                });
+        });
+
         connect(this, &ChatPage::startConsesusTimer, this, [this]() {
                 consensusTimer_->start(CONSENSUS_TIMEOUT);
                 showContentTimer_->start(SHOW_CONTENT_TIMEOUT);
         });
         connect(this, &ChatPage::initializeRoomList, room_list_, &RoomList::initialize);
+        connect(this, &ChatPage::cacheMigrated, this, [this]() {
+                emit changeWindowTitle("nheko");
+                loadCache();
+        });
         connect(this,
                 &ChatPage::initializeViews,
                 view_manager_,
                 [this](const mtx::responses::Rooms &rooms) { view_manager_->initialize(rooms); });
-        connect(
-          this,
-          &ChatPage::initializeEmptyViews,
-          this,
-          [this](const std::vector<std::string> &rooms) { view_manager_->initialize(rooms); });
+        connect(this,
+                &ChatPage::initializeCachedViews,
+                this,
+                [this](const std::map<QString, mtx::responses::Timeline> &msgs) {
+                        view_manager_->initialize(msgs);
+                });
         connect(this, &ChatPage::syncUI, this, [this](const mtx::responses::Rooms &rooms) {
                 try {
                         room_list_->cleanupInvites(cache_->invites());
@@ -444,6 +490,8 @@ ChatPage::ChatPage(QSharedPointer<MatrixClient> client,
         qRegisterMetaType<QMap<QString, RoomInfo>>();
         qRegisterMetaType<mtx::responses::Rooms>();
         qRegisterMetaType<std::vector<std::string>>();
+        qRegisterMetaType<std::vector<MessageSearchResult>>();
+        qRegisterMetaType<std::map<QString, mtx::responses::Timeline>>();
 }
 
 void
@@ -481,6 +529,10 @@ ChatPage::deleteConfigs()
         settings.remove("");
         settings.endGroup();
 
+        // Drop the queued sync responses before the cache is removed.
+        syncStopped_ = true;
+        syncPipeline_.waitForDone();
+
         cache_->deleteData();
 
         client_->reset();
@@ -494,21 +546,78 @@ ChatPage::bootstrap(QString userid, QString homeserver, QString token)
         client_->getOwnProfile();
         client_->getOwnCommunities();
 
+        syncStopped_  = false;
+        syncFailed_   = false;
+        pendingSyncs_ = 0;
+        pausedBatchToken_.clear();
+
         cache_ = QSharedPointer<Cache>(new Cache(userid));
         room_list_->setCache(cache_);
         text_input_->setCache(cache_);
 
         AvatarProvider::init(client_, cache_);
 
+        connect(cache_.data(), &Cache::migrationProgress, this, [this](int done, int total) {
+                emit changeWindowTitle(
+                  tr("nheko - Upgrading the cache (%1/%2)").arg(done).arg(total));
+        });
+        connect(cache_.data(),
+                &Cache::membersLoaded,
+                view_manager_,
+                &TimelineViewManager::refreshSenders);
+
+        bool needsMigration = false;
+
         try {
                 cache_->setup();
+                needsMigration = cache_->needsMigration();
+        } catch (const lmdb::error &e) {
+                qCritical() << "Cache failure" << e.what();
+                cache_->deleteData();
+                qInfo() << "Falling back to initial sync ...";
+
+                client_->initialSync();
+                initialSyncTimer_->start(INITIAL_SYNC_RETRY_TIMEOUT);
+                return;
+        }
+
+        if (!needsMigration) {
+                loadCache();
+                return;
+        }
+
+        emit changeWindowTitle(tr("nheko - Upgrading the cache"));
 
+        // The upgrade can take a while on large accounts, so it runs in the
+        // background while its progress is shown.
+        auto cache = cache_;
+
+        QtConcurrent::run([this, cache]() {
+                cache->runMigrations();
+                emit cacheMigrated();
+        });
+}
+
+void
+ChatPage::loadCache()
+{
+        try {
                 if (!cache_->isFormatValid()) {
                         cache_->deleteData();
                         cache_->setup();
                         cache_->setCurrentFormat();
                 }
 
+                // Clean up after the removed rooms & compact the cache once the
+                // startup work is done. The compaction holds up the writes.
+                auto cache = cache_;
+                QTimer::singleShot(CACHE_GC_DELAY, this, [cache]() {
+                        cache->runMaintenance([](Cache &cache) {
+                                cache.collectGarbage();
+                                cache.compactIfNeeded();
+                        });
+                });
+
                 if (cache_->isInitialized()) {
                         loadStateFromCache();
                         return;
@@ -529,18 +638,33 @@ ChatPage::syncCompleted(const mtx::responses::Sync &response)
 {
         syncTimeoutTimer_->stop();
 
-        QtConcurrent::run([this, res = std::move(response)]() {
-                try {
-                        cache_->saveState(res);
-                        emit syncUI(res.rooms);
-                        emit syncRoomlist(cache_->roomUpdates(res));
-                } catch (const lmdb::error &e) {
-                        std::cout << "save cache error:" << e.what() << '\n';
-                        // TODO: retry sync.
-                        return;
+        if (syncStopped_ || syncFailed_)
+                return;
+
+        // Fetch the next batch while this one is saved & applied.
+        const auto next_batch = QString::fromStdString(response.next_batch);
+
+        if (++pendingSyncs_ < MAX_PENDING_SYNCS)
+                emit continueSync(next_batch);
+        else
+                pausedBatchToken_ = next_batch;
+
+        QtConcurrent::run(&syncPipeline_, [this, res = response]() {
+                // The responses after a failed one are dropped, since the
+                // sync restarts from the last saved token.
+                if (!syncStopped_ && !syncFailed_) {
+                        try {
+                                cache_->saveState(res);
+                                emit syncUI(res.rooms);
+                                emit syncRoomlist(cache_->roomUpdates(res));
+                        } catch (const lmdb::error &e) {
+                                qCritical() << "failed to save the sync response:" << e.what();
+                                syncFailed_ = true;
+                                emit syncSaveFailed();
+                        }
                 }
 
-                emit continueSync(cache_->nextBatchToken());
+                emit syncProcessed();
         });
 }
 
@@ -562,7 +686,7 @@ ChatPage::initialSyncCompleted(const mtx::responses::Sync &response)
                         return;
                 }
 
-                emit continueSync(cache_->nextBatchToken());
+                emit continueSync(QString::fromStdString(res.next_batch));
                 emit contentLoaded();
         });
 }
@@ -637,13 +761,14 @@ ChatPage::changeTopRoomInfo(const QString &room_id)
                 if (room_info.find(room_id) == room_info.end())
                         return;
 
-                const auto name       = QString::fromStdString(room_info[room_id].name);
-                const auto avatar_url = QString::fromStdString(room_info[room_id].avatar_url);
+                const auto &info = room_info[room_id];
+                const auto name  = QString::fromStdString(info.name);
 
                 top_bar_->updateRoomName(name);
-                top_bar_->updateRoomTopic(QString::fromStdString(room_info[room_id].topic));
+                top_bar_->updateRoomTopic(QString::fromStdString(info.topic));
 
-                auto img = cache_->getRoomAvatar(room_id);
+                // The avatar url is already known, so there is no need for another lookup.
+                auto img = cache_->getRoomAvatar(info);
 
                 if (img.isNull())
                         top_bar_->updateRoomAvatarFromName(name);
@@ -655,6 +780,43 @@ ChatPage::changeTopRoomInfo(const QString &room_id)
         }
 
         current_room_ = room_id;
+
+        client_->setVisibleRoom(room_id);
+}
+
+void
+ChatPage::flushCache()
+{
+        if (!cache_.isNull())
+                cache_->flush();
+}
+
+void
+ChatPage::compactCache()
+{
+        if (cache_.isNull())
+                return;
+
+        cache_->runMaintenance([](Cache &cache) {
+                const auto before = cache.statistics();
+
+                for (const auto &table : before.tables)
+                        qDebug() << QString::fromStdString(table.name) << table.entries
+                                 << "entries" << table.pages << "pages" << table.depth << "depth";
+
+                const auto media = cache.mediaStatistics();
+                qDebug() << "media cache:" << media.hits << "hits" << media.misses << "misses"
+                         << media.evictions << "evictions" << media.size << "of" << media.limit
+                         << "bytes";
+
+                if (!cache.compact())
+                        return;
+
+                const auto after = cache.statistics();
+
+                qInfo() << "cache data reduced from" << before.used_pages * before.page_size
+                        << "to" << after.used_pages * after.page_size << "bytes";
+        });
 }
 
 void
@@ -676,9 +838,7 @@ ChatPage::loadStateFromCache()
 
         QtConcurrent::run([this]() {
                 try {
-                        cache_->populateMembers();
-
-                        emit initializeEmptyViews(cache_->joinedRooms());
+                        emit initializeCachedViews(cache_->roomMessages());
                         emit initializeRoomList(cache_->roomInfo());
                 } catch (const lmdb::error &e) {
                         std::cout << "load cache error:" << e.what() << '\n';
@@ -791,6 +951,66 @@ ChatPage::removeLeftRooms(const std::map<std::string, mtx::responses::LeftRoom>
         }
 }
 
+void
+ChatPage::showMessageSearch()
+{
+        if (messageSearch_.isNull()) {
+                messageSearch_ = QSharedPointer<dialogs::MessageSearch>(
+                  new dialogs::MessageSearch(this),
+                  [](dialogs::MessageSearch *dialog) { dialog->deleteLater(); });
+
+                // The search reads the cache, so it runs in the background.
+                connect(messageSearch_.data(),
+                        &dialogs::MessageSearch::queryChanged,
+                        this,
+                        [this](const QString &query) {
+                                auto cache = cache_;
+
+                                QtConcurrent::run([this, cache, query]() {
+                                        emit messageSearchFinished(query,
+                                                                   cache->searchMessages(query));
+                                });
+                        });
+
+                connect(this,
+                        &ChatPage::messageSearchFinished,
+                        this,
+                        [this](const QString &query,
+                               const std::vector<MessageSearchResult> &results) {
+                                // The query was edited while the search was running.
+                                if (query != messageSearch_->query())
+                                        return;
+
+                                messageSearch_->setResults(results, cache_->roomInfo(false));
+                        });
+
+                connect(messageSearch_.data(),
+                        &dialogs::MessageSearch::resultSelected,
+                        this,
+                        [this](const QString &room_id, const QString &event_id) {
+                                if (!messageSearchModal_.isNull())
+                                        messageSearchModal_->hide();
+                                room_list_->highlightSelectedRoom(room_id);
+                                view_manager_->scrollToEvent(room_id, event_id);
+                        });
+
+                connect(messageSearch_.data(), &dialogs::MessageSearch::closing, this, [this]() {
+                        if (!messageSearchModal_.isNull())
+                                messageSearchModal_->hide();
+                        text_input_->setFocus(Qt::FocusReason::PopupFocusReason);
+                });
+        }
+
+        if (messageSearchModal_.isNull()) {
+                messageSearchModal_ = QSharedPointer<OverlayModal>(
+                  new OverlayModal(MainWindow::instance(), messageSearch_.data()),
+                  [](OverlayModal *modal) { modal->deleteLater(); });
+                messageSearchModal_->setColor(QColor(30, 30, 30, 170));
+        }
+
+        messageSearchModal_->show();
+}
+
 void
 ChatPage::showReadReceipts(const QString &event_id)
 {
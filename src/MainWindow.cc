@@ -110,6 +110,10 @@ MainWindow::MainWindow(QWidget *parent)
 
         connect(
           userSettingsPage_, SIGNAL(trayOptionChanged(bool)), trayIcon_, SLOT(setVisible(bool)));
+        connect(userSettingsPage_,
+                &UserSettingsPage::compactCache,
+                chat_page_,
+                &ChatPage::compactCache);
 
         connect(trayIcon_,
                 SIGNAL(activated(QSystemTrayIcon::ActivationReason)),
@@ -130,6 +134,9 @@ MainWindow::MainWindow(QWidget *parent)
                 this,
                 SLOT(showChatPage(QString, QString, QString)));
 
+        // The cache might not be synced on every commit.
+        connect(qApp, &QApplication::aboutToQuit, chat_page_, &ChatPage::flushCache);
+
         QShortcut *quitShortcut = new QShortcut(QKeySequence::Quit, this);
         connect(quitShortcut, &QShortcut::activated, this, QApplication::quit);
 
@@ -139,6 +146,12 @@ MainWindow::MainWindow(QWidget *parent)
                         chat_page_->showQuickSwitcher();
         });
 
+        QShortcut *messageSearchShortcut = new QShortcut(QKeySequence("Ctrl+Shift+F"), this);
+        connect(messageSearchShortcut, &QShortcut::activated, this, [this]() {
+                if (chat_page_->isVisible() && !hasActiveDialogs())
+                        chat_page_->showMessageSearch();
+        });
+
         QSettings settings;
 
         trayIcon_->setVisible(userSettings_->isTrayEnabled());
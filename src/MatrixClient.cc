@@ -28,11 +28,27 @@
 #include <QProcessEnvironment>
 #include <QSettings>
 #include <QUrlQuery>
-#include <QtConcurrent>
 #include <mtx/errors.hpp>
 
 #include "Deserializable.h"
 #include "MatrixClient.h"
+#include "SyncDecoder.h"
+
+//! Move the body of a sync response to a decoder as it's received.
+static QSharedPointer<SyncDecoder>
+collectSyncResponse(QNetworkReply *reply)
+{
+        auto decoder = QSharedPointer<SyncDecoder>(new SyncDecoder);
+
+        QObject::connect(reply, &QNetworkReply::metaDataChanged, reply, [reply, decoder]() {
+                decoder->reserve(reply->header(QNetworkRequest::ContentLengthHeader).toLongLong());
+        });
+        QObject::connect(reply, &QNetworkReply::readyRead, reply, [reply, decoder]() {
+                decoder->append(reply->readAll());
+        });
+
+        return decoder;
+}
 
 MatrixClient::MatrixClient(QString server, QObject *parent)
   : QNetworkAccessManager(parent)
@@ -40,6 +56,9 @@ MatrixClient::MatrixClient(QString server, QObject *parent)
   , mediaApiUrl_{"/_matrix/media/r0"}
   , serverProtocol_{"https"}
 {
+        responseDecoder_ = new ResponseDecoder(this);
+        scheduler_       = new RequestScheduler(this);
+
         QSettings settings;
         txn_id_ = settings.value("client/transaction_id", 1).toInt();
 
@@ -99,6 +118,64 @@ MatrixClient::MatrixClient(QString server, QObject *parent)
                 });
 }
 
+QNetworkReply *
+MatrixClient::createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData)
+{
+        QNetworkRequest req(request);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+        // Multiplex the media & the pagination requests with the long-polling sync
+        // over a single connection. Servers without HTTP/2 negotiate HTTP/1.1.
+        if (req.url().host() == server_.host())
+                req.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+
+        // Qt asks for gzip & deflate and decodes the response, unless the request
+        // sets its own encoding. The media are already compressed.
+        if (req.url().path().startsWith(mediaApiUrl_))
+                req.setRawHeader("Accept-Encoding", "identity");
+
+        auto reply = QNetworkAccessManager::createRequest(op, req, outgoingData);
+        recordTransfer(reply);
+
+        return reply;
+}
+
+void
+MatrixClient::recordTransfer(QNetworkReply *reply)
+{
+        auto decoded = QSharedPointer<qint64>(new qint64(0));
+
+        connect(reply, &QNetworkReply::downloadProgress, this, [decoded](qint64 received, qint64) {
+                *decoded = received;
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, reply, decoded]() {
+                bool http2 = false;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+                http2 = reply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool();
+#endif
+
+                transfers_.requests += 1;
+                transfers_.http2_requests += http2 ? 1 : 0;
+
+                // The progress counts the decoded bytes, so the size on the wire
+                // of a compressed response is only known from its header.
+                const auto encoding = reply->rawHeader("Content-Encoding");
+                const auto length   = reply->header(QNetworkRequest::ContentLengthHeader);
+
+                if (encoding.isEmpty() || encoding == "identity") {
+                        transfers_.wire_bytes += static_cast<uint64_t>(*decoded);
+                        transfers_.decoded_bytes += static_cast<uint64_t>(*decoded);
+                } else if (length.isValid()) {
+                        transfers_.wire_bytes += static_cast<uint64_t>(length.toLongLong());
+                        transfers_.decoded_bytes += static_cast<uint64_t>(*decoded);
+                } else {
+                        transfers_.unmeasured_requests += 1;
+                        transfers_.unmeasured_bytes += static_cast<uint64_t>(*decoded);
+                }
+        });
+}
+
 void
 MatrixClient::reset() noexcept
 {
@@ -106,9 +183,20 @@ MatrixClient::reset() noexcept
         server_.clear();
         token_.clear();
 
+        scheduler_->clear();
+
         txn_id_ = 0;
 }
 
+void
+MatrixClient::abortSync()
+{
+        syncGeneration_ += 1;
+
+        if (syncReply_)
+                syncReply_->abort();
+}
+
 void
 MatrixClient::login(const QString &username, const QString &password) noexcept
 {
@@ -162,22 +250,24 @@ MatrixClient::login(const QString &username, const QString &password) noexcept
                         return;
                 }
 
-                try {
-                        mtx::responses::Login login =
-                          nlohmann::json::parse(reply->readAll().data());
-
-                        auto hostname = server_.host();
-
-                        if (server_.port() > 0)
-                                hostname = QString("%1:%2").arg(server_.host()).arg(server_.port());
-
-                        emit loginSuccess(QString::fromStdString(login.user_id.to_string()),
-                                          hostname,
-                                          QString::fromStdString(login.access_token));
-                } catch (std::exception &e) {
-                        qWarning() << "Malformed JSON response" << e.what();
-                        emit loginError(tr("Malformed response. Possibly not a Matrix server"));
-                }
+                responseDecoder_->run<mtx::responses::Login>(
+                  "login",
+                  [data = reply->readAll()]() { return nlohmann::json::parse(data.data()); },
+                  [this](mtx::responses::Login &login) {
+                          auto hostname = server_.host();
+
+                          if (server_.port() > 0)
+                                  hostname =
+                                    QString("%1:%2").arg(server_.host()).arg(server_.port());
+
+                          emit loginSuccess(QString::fromStdString(login.user_id.to_string()),
+                                            hostname,
+                                            QString::fromStdString(login.access_token));
+                  },
+                  [this](const QString &error) {
+                          qWarning() << "Malformed JSON response" << error;
+                          emit loginError(tr("Malformed response. Possibly not a Matrix server"));
+                  });
         });
 }
 void
@@ -305,26 +395,47 @@ MatrixClient::sync() noexcept
 
         QNetworkRequest request(QString(endpoint.toEncoded()));
 
-        auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
-                reply->deleteLater();
+        const auto generation = syncGeneration_;
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        auto start = [this, request, generation]() -> QNetworkReply * {
+                // The sync was aborted before it started.
+                if (generation != syncGeneration_)
+                        return nullptr;
 
-                if (status == 0 || status >= 400) {
-                        qDebug() << reply->errorString();
-                        return;
-                }
+                auto reply   = get(request);
+                auto decoder = collectSyncResponse(reply);
 
-                auto data = reply->readAll();
+                syncReply_ = reply;
 
-                try {
-                        mtx::responses::Sync response = nlohmann::json::parse(data);
-                        emit syncCompleted(response);
-                } catch (std::exception &e) {
-                        qWarning() << "Sync error: " << e.what();
-                }
-        });
+                auto finished = [this, reply, decoder, generation]() {
+                        reply->deleteLater();
+
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+                        if (status == 0 || status >= 400 || generation != syncGeneration_) {
+                                qDebug() << reply->errorString();
+                                return;
+                        }
+
+                        decoder->append(reply->readAll());
+
+                        responseDecoder_->run<mtx::responses::Sync>(
+                          "sync",
+                          [decoder]() { return decoder->decode(); },
+                          [this, generation](mtx::responses::Sync &response) {
+                                  if (generation == syncGeneration_)
+                                          emit syncCompleted(response);
+                          },
+                          [](const QString &error) { qWarning() << "Sync error:" << error; });
+                };
+
+                connect(reply, &QNetworkReply::finished, this, finished);
+
+                return reply;
+        };
+
+        scheduler_->enqueue(RequestPriority::Sync, QString(), start);
 }
 
 void
@@ -374,42 +485,47 @@ MatrixClient::sendRoomMessage(mtx::events::MessageType ty,
         QNetworkRequest request(QString(endpoint.toEncoded()));
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
 
-        auto reply = put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+        scheduler_->enqueue(RequestPriority::Send, roomid, [this, request, body, roomid, txnId]() {
+                auto reply = put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
 
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, txnId]() {
-                reply->deleteLater();
+                connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, txnId]() {
+                        reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                if (status == 0 || status >= 400) {
-                        emit messageSendFailed(roomid, txnId);
-                        return;
-                }
+                        if (status == 0 || status >= 400) {
+                                emit messageSendFailed(roomid, txnId);
+                                return;
+                        }
 
-                auto data = reply->readAll();
+                        auto data = reply->readAll();
 
-                if (data.isEmpty()) {
-                        emit messageSendFailed(roomid, txnId);
-                        return;
-                }
+                        if (data.isEmpty()) {
+                                emit messageSendFailed(roomid, txnId);
+                                return;
+                        }
 
-                auto json = QJsonDocument::fromJson(data);
+                        auto json = QJsonDocument::fromJson(data);
 
-                if (!json.isObject()) {
-                        qDebug() << "Send message response is not a JSON object";
-                        emit messageSendFailed(roomid, txnId);
-                        return;
-                }
+                        if (!json.isObject()) {
+                                qDebug() << "Send message response is not a JSON object";
+                                emit messageSendFailed(roomid, txnId);
+                                return;
+                        }
 
-                auto object = json.object();
+                        auto object = json.object();
 
-                if (!object.contains("event_id")) {
-                        qDebug() << "SendTextMessage: missing event_id from response";
-                        emit messageSendFailed(roomid, txnId);
-                        return;
-                }
+                        if (!object.contains("event_id")) {
+                                qDebug() << "SendTextMessage: missing event_id from response";
+                                emit messageSendFailed(roomid, txnId);
+                                return;
+                        }
 
-                emit messageSent(object.value("event_id").toString(), roomid, txnId);
+                        emit messageSent(object.value("event_id").toString(), roomid, txnId);
+                });
+
+                return reply;
         });
 }
 
@@ -427,27 +543,39 @@ MatrixClient::initialSync() noexcept
 
         QNetworkRequest request(QString(endpoint.toEncoded()));
 
-        auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
-                reply->deleteLater();
+        scheduler_->enqueue(RequestPriority::Sync, QString(), [this, request]() {
+                auto reply   = get(request);
+                auto decoder = collectSyncResponse(reply);
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                connect(reply, &QNetworkReply::finished, this, [this, reply, decoder]() {
+                        reply->deleteLater();
 
-                if (status == 0 || status >= 400) {
-                        qDebug() << "Error code received" << status;
-                        emit initialSyncFailed(status);
-                        return;
-                }
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                qRegisterMetaType<mtx::responses::Sync>();
-                QtConcurrent::run([data = reply->readAll(), this]() {
-                        try {
-                                emit initialSyncCompleted(nlohmann::json::parse(std::move(data)));
-                        } catch (std::exception &e) {
-                                qWarning() << "Initial sync error:" << e.what();
-                                emit initialSyncFailed();
+                        if (status == 0 || status >= 400) {
+                                qDebug() << "Error code received" << status;
+                                emit initialSyncFailed(status);
+                                return;
                         }
+
+                        decoder->append(reply->readAll());
+
+                        qRegisterMetaType<mtx::responses::Sync>();
+
+                        responseDecoder_->run<mtx::responses::Sync>(
+                          "sync",
+                          [decoder]() { return decoder->decode(); },
+                          [this](mtx::responses::Sync &response) {
+                                  emit initialSyncCompleted(response);
+                          },
+                          [this](const QString &error) {
+                                  qWarning() << "Initial sync error:" << error;
+                                  emit initialSyncFailed();
+                          });
                 });
+
+                return reply;
         });
 }
 
@@ -482,14 +610,13 @@ MatrixClient::versions() noexcept
                         return;
                 }
 
-                try {
-                        mtx::responses::Versions versions =
-                          nlohmann::json::parse(reply->readAll().data());
-
-                        emit versionSuccess();
-                } catch (std::exception &e) {
-                        emit versionError("Malformed response. Possibly not a Matrix server");
-                }
+                responseDecoder_->run<mtx::responses::Versions>(
+                  "versions",
+                  [data = reply->readAll()]() { return nlohmann::json::parse(data.data()); },
+                  [this](mtx::responses::Versions &) { emit versionSuccess(); },
+                  [this](const QString &) {
+                          emit versionError("Malformed response. Possibly not a Matrix server");
+                  });
         });
 }
 
@@ -521,15 +648,15 @@ MatrixClient::getOwnProfile() noexcept
                         return;
                 }
 
-                try {
-                        mtx::responses::Profile profile =
-                          nlohmann::json::parse(reply->readAll().data());
-
-                        emit getOwnProfileResponse(QUrl(QString::fromStdString(profile.avatar_url)),
-                                                   QString::fromStdString(profile.display_name));
-                } catch (std::exception &e) {
-                        qWarning() << "Profile:" << e.what();
-                }
+                responseDecoder_->run<mtx::responses::Profile>(
+                  "profile",
+                  [data = reply->readAll()]() { return nlohmann::json::parse(data.data()); },
+                  [this](mtx::responses::Profile &profile) {
+                          emit getOwnProfileResponse(
+                            QUrl(QString::fromStdString(profile.avatar_url)),
+                            QString::fromStdString(profile.display_name));
+                  },
+                  [](const QString &error) { qWarning() << "Profile:" << error; });
         });
 }
 
@@ -556,19 +683,19 @@ MatrixClient::getOwnCommunities() noexcept
                         return;
                 }
 
-                auto data = reply->readAll();
-                auto json = QJsonDocument::fromJson(data).object();
+                responseDecoder_->run<QList<QString>>(
+                  "communities",
+                  [data = reply->readAll()]() {
+                          auto json = QJsonDocument::fromJson(data).object();
 
-                try {
-                        QList<QString> response;
+                          QList<QString> response;
 
-                        for (auto group : json["groups"].toArray())
-                                response.append(group.toString());
+                          for (auto group : json["groups"].toArray())
+                                  response.append(group.toString());
 
-                        emit getOwnCommunitiesResponse(response);
-                } catch (DeserializationException &e) {
-                        qWarning() << "Own communities:" << e.what();
-                }
+                          return response;
+                  },
+                  [this](QList<QString> &response) { emit getOwnCommunitiesResponse(response); });
         });
 }
 
@@ -595,27 +722,37 @@ MatrixClient::fetchRoomAvatar(const QString &roomid, const QUrl &avatar_url)
 
         QNetworkRequest avatar_request(endpoint);
 
-        QNetworkReply *reply = get(avatar_request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, avatar_url]() {
-                reply->deleteLater();
+        auto start = [this, avatar_request, roomid, avatar_url]() {
+                QNetworkReply *reply = get(avatar_request);
+                connect(reply, &QNetworkReply::finished, this, [this, reply, roomid, avatar_url]() {
+                        reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
+                        if (status == 0 || status >= 400) {
+                                qWarning() << reply->errorString();
+                                return;
+                        }
 
-                auto img = reply->readAll();
+                        auto img = reply->readAll();
 
-                if (img.size() == 0)
-                        return;
+                        if (img.size() == 0)
+                                return;
 
-                QPixmap pixmap;
-                pixmap.loadFromData(img);
+                        responseDecoder_->run<QImage>(
+                          "avatars",
+                          [img]() { return QImage::fromData(img); },
+                          [this, roomid, avatar_url, img](QImage &image) {
+                                  emit roomAvatarRetrieved(
+                                    roomid, QPixmap::fromImage(image), avatar_url.toString(), img);
+                          });
+                });
 
-                emit roomAvatarRetrieved(roomid, pixmap, avatar_url.toString(), img);
-        });
+                return reply;
+        };
+
+        scheduler_->enqueue(RequestPriority::Media, roomid, start);
 }
 
 void
@@ -644,27 +781,38 @@ MatrixClient::fetchCommunityAvatar(const QString &communityId, const QUrl &avata
 
         QNetworkRequest avatar_request(endpoint);
 
-        QNetworkReply *reply = get(avatar_request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, communityId]() {
-                reply->deleteLater();
+        auto start = [this, avatar_request, communityId]() {
+                QNetworkReply *reply = get(avatar_request);
+                connect(reply, &QNetworkReply::finished, this, [this, reply, communityId]() {
+                        reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
+                        if (status == 0 || status >= 400) {
+                                qWarning() << reply->errorString();
+                                return;
+                        }
 
-                auto img = reply->readAll();
+                        auto img = reply->readAll();
 
-                if (img.size() == 0)
-                        return;
+                        if (img.size() == 0)
+                                return;
 
-                QPixmap pixmap;
-                pixmap.loadFromData(img);
+                        responseDecoder_->run<QImage>(
+                          "avatars",
+                          [img]() { return QImage::fromData(img); },
+                          [this, communityId](QImage &image) {
+                                  emit communityAvatarRetrieved(communityId,
+                                                                QPixmap::fromImage(image));
+                          });
+                });
 
-                emit communityAvatarRetrieved(communityId, pixmap);
-        });
+                return reply;
+        };
+
+        // Shown in the side bar, whichever room is open.
+        scheduler_->enqueue(RequestPriority::Media, QString(), start);
 }
 
 void
@@ -691,10 +839,12 @@ MatrixClient::fetchCommunityProfile(const QString &communityId)
                         return;
                 }
 
-                auto data       = reply->readAll();
-                const auto json = QJsonDocument::fromJson(data).object();
-
-                emit communityProfileRetrieved(communityId, json);
+                responseDecoder_->run<QJsonObject>(
+                  "communities",
+                  [data = reply->readAll()]() { return QJsonDocument::fromJson(data).object(); },
+                  [this, communityId](QJsonObject &json) {
+                          emit communityProfileRetrieved(communityId, json);
+                  });
         });
 }
 
@@ -721,15 +871,17 @@ MatrixClient::fetchCommunityRooms(const QString &communityId)
                         return;
                 }
 
-                auto data       = reply->readAll();
-                const auto json = QJsonDocument::fromJson(data).object();
-
-                emit communityRoomsRetrieved(communityId, json);
+                responseDecoder_->run<QJsonObject>(
+                  "communities",
+                  [data = reply->readAll()]() { return QJsonDocument::fromJson(data).object(); },
+                  [this, communityId](QJsonObject &json) {
+                          emit communityRoomsRetrieved(communityId, json);
+                  });
         });
 }
 
 QSharedPointer<DownloadMediaProxy>
-MatrixClient::fetchUserAvatar(const QUrl &avatarUrl)
+MatrixClient::fetchUserAvatar(const QUrl &avatarUrl, const QString &room_id)
 {
         QList<QString> url_parts = avatarUrl.toString().split("mxc://");
 
@@ -749,92 +901,115 @@ MatrixClient::fetchUserAvatar(const QUrl &avatarUrl)
 
         QNetworkRequest avatar_request(endpoint);
 
-        auto reply = get(avatar_request);
         auto proxy = QSharedPointer<DownloadMediaProxy>(new DownloadMediaProxy,
                                                         [](auto proxy) { proxy->deleteLater(); });
-        connect(reply, &QNetworkReply::finished, this, [reply, proxy, avatarUrl]() {
-                reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        auto start = [this, avatar_request, proxy, avatarUrl]() {
+                auto reply = get(avatar_request);
+                connect(reply, &QNetworkReply::finished, this, [this, reply, proxy, avatarUrl]() {
+                        reply->deleteLater();
 
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString() << avatarUrl;
-                        return;
-                }
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                auto data = reply->readAll();
+                        if (status == 0 || status >= 400) {
+                                qWarning() << reply->errorString() << avatarUrl;
+                                return;
+                        }
 
-                if (data.size() == 0) {
-                        qWarning() << "received avatar with no data:" << avatarUrl;
-                        return;
-                }
+                        auto data = reply->readAll();
 
-                QImage img;
-                img.loadFromData(data);
+                        if (data.size() == 0) {
+                                qWarning() << "received avatar with no data:" << avatarUrl;
+                                return;
+                        }
 
-                emit proxy->avatarDownloaded(img);
-        });
+                        responseDecoder_->run<QImage>(
+                          "avatars",
+                          [data]() { return QImage::fromData(data); },
+                          [proxy](QImage &img) { emit proxy->avatarDownloaded(img); });
+                });
+
+                return reply;
+        };
+
+        scheduler_->enqueue(RequestPriority::Media, room_id, start);
 
         return proxy;
 }
 
 QSharedPointer<DownloadMediaProxy>
-MatrixClient::downloadImage(const QUrl &url)
+MatrixClient::downloadImage(const QUrl &url, const QString &room_id)
 {
         QNetworkRequest image_request(url);
 
-        auto reply = get(image_request);
         auto proxy = QSharedPointer<DownloadMediaProxy>(new DownloadMediaProxy,
                                                         [](auto proxy) { proxy->deleteLater(); });
-        connect(reply, &QNetworkReply::finished, this, [reply, proxy]() {
-                reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        scheduler_->enqueue(RequestPriority::Media, room_id, [this, image_request, proxy]() {
+                auto reply = get(image_request);
+                connect(reply, &QNetworkReply::finished, this, [this, reply, proxy]() {
+                        reply->deleteLater();
 
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+                        if (status == 0 || status >= 400) {
+                                qWarning() << reply->errorString();
+                                return;
+                        }
 
-                auto img = reply->readAll();
+                        auto img = reply->readAll();
 
-                if (img.size() == 0)
-                        return;
+                        if (img.size() == 0)
+                                return;
 
-                QPixmap pixmap;
-                pixmap.loadFromData(img);
+                        responseDecoder_->run<QImage>(
+                          "images",
+                          [img]() { return QImage::fromData(img); },
+                          [proxy](QImage &image) {
+                                  emit proxy->imageDownloaded(QPixmap::fromImage(image));
+                          });
+                });
 
-                emit proxy->imageDownloaded(pixmap);
+                return reply;
         });
 
         return proxy;
 }
 
 QSharedPointer<DownloadMediaProxy>
-MatrixClient::downloadFile(const QUrl &url)
+MatrixClient::downloadFile(const QUrl &url, const QString &room_id)
 {
         QNetworkRequest fileRequest(url);
 
-        auto reply = get(fileRequest);
         auto proxy = QSharedPointer<DownloadMediaProxy>(new DownloadMediaProxy,
                                                         [](auto proxy) { proxy->deleteLater(); });
-        connect(reply, &QNetworkReply::finished, this, [reply, proxy]() {
-                reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        // Requested by the user.
+        scheduler_->enqueue(RequestPriority::Send, room_id, [this, fileRequest, proxy]() {
+                auto reply = get(fileRequest);
+                connect(reply, &QNetworkReply::finished, this, [reply, proxy]() {
+                        reply->deleteLater();
 
-                if (status == 0 || status >= 400) {
-                        // TODO: Handle error
-                        qWarning() << reply->errorString();
-                        return;
-                }
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                auto data = reply->readAll();
+                        if (status == 0 || status >= 400) {
+                                // TODO: Handle error
+                                qWarning() << reply->errorString();
+                                return;
+                        }
 
-                if (data.size() == 0)
-                        return;
+                        auto data = reply->readAll();
+
+                        if (data.size() == 0)
+                                return;
 
-                emit proxy->fileDownloaded(data);
+                        emit proxy->fileDownloaded(data);
+                });
+
+                return reply;
         });
 
         return proxy;
@@ -855,26 +1030,33 @@ MatrixClient::messages(const QString &roomid, const QString &from_token, int lim
 
         QNetworkRequest request(QString(endpoint.toEncoded()));
 
-        auto reply = get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, roomid]() {
-                reply->deleteLater();
+        scheduler_->enqueue(RequestPriority::Pagination, roomid, [this, request, roomid]() {
+                auto reply = get(request);
+                connect(reply, &QNetworkReply::finished, this, [this, reply, roomid]() {
+                        reply->deleteLater();
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
+                        if (status == 0 || status >= 400) {
+                                qWarning() << reply->errorString();
+                                return;
+                        }
 
-                try {
-                        mtx::responses::Messages messages =
-                          nlohmann::json::parse(reply->readAll().data());
+                        responseDecoder_->run<mtx::responses::Messages>(
+                          "messages",
+                          [data = reply->readAll()]() {
+                                  return nlohmann::json::parse(data.data());
+                          },
+                          [this, roomid](mtx::responses::Messages &messages) {
+                                  emit messagesRetrieved(roomid, messages);
+                          },
+                          [roomid](const QString &error) {
+                                  qWarning() << "Room messages from" << roomid << error;
+                          });
+                });
 
-                        emit messagesRetrieved(roomid, messages);
-                } catch (std::exception &e) {
-                        qWarning() << "Room messages from" << roomid << e.what();
-                        return;
-                }
+                return reply;
         });
 }
 
@@ -1187,7 +1369,9 @@ MatrixClient::sendTypingNotification(const QString &roomid, int timeoutInMillis)
         QNetworkRequest request(QString(endpoint.toEncoded()));
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
 
-        put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+        scheduler_->enqueue(RequestPriority::Send, roomid, [this, request, body]() {
+                return put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+        });
 }
 
 void
@@ -1212,7 +1396,9 @@ MatrixClient::removeTypingNotification(const QString &roomid)
         QNetworkRequest request(QString(endpoint.toEncoded()));
         request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
 
-        put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+        scheduler_->enqueue(RequestPriority::Send, roomid, [this, request, body]() {
+                return put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
+        });
 }
 
 void
@@ -1229,17 +1415,23 @@ MatrixClient::readEvent(const QString &room_id, const QString &event_id)
         request.setHeader(QNetworkRequest::KnownHeaders::ContentTypeHeader, "application/json");
 
         QJsonObject body({{"m.fully_read", event_id}, {"m.read", event_id}});
-        auto reply = post(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
 
-        connect(reply, &QNetworkReply::finished, this, [reply]() {
-                reply->deleteLater();
+        scheduler_->enqueue(RequestPriority::Send, room_id, [this, request, body]() {
+                auto reply = post(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                connect(reply, &QNetworkReply::finished, this, [reply]() {
+                        reply->deleteLater();
 
-                if (status == 0 || status >= 400) {
-                        qWarning() << reply->errorString();
-                        return;
-                }
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+                        if (status == 0 || status >= 400) {
+                                qWarning() << reply->errorString();
+                                return;
+                        }
+                });
+
+                return reply;
         });
 }
 
@@ -1325,28 +1517,39 @@ MatrixClient::redactEvent(const QString &room_id, const QString &event_id)
 
         // TODO: no reason specified
         QJsonObject body{};
-        auto reply = put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
 
-        connect(reply, &QNetworkReply::finished, this, [reply, this, room_id, event_id]() {
-                reply->deleteLater();
+        auto start = [this, request, body, room_id, event_id]() {
+                auto reply = put(request, QJsonDocument(body).toJson(QJsonDocument::Compact));
 
-                int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-                auto data  = reply->readAll();
+                connect(reply, &QNetworkReply::finished, this, [reply, this, room_id, event_id]() {
+                        reply->deleteLater();
 
-                if (status == 0 || status >= 400) {
-                        try {
-                                mtx::errors::Error res = nlohmann::json::parse(data);
-                                emit redactionFailed(QString::fromStdString(res.error));
+                        int status =
+                          reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                        auto data = reply->readAll();
+
+                        if (status == 0 || status >= 400) {
+                                responseDecoder_->run<mtx::errors::Error>(
+                                  "redactions",
+                                  [data]() { return nlohmann::json::parse(data.data()); },
+                                  [this](mtx::errors::Error &res) {
+                                          emit redactionFailed(QString::fromStdString(res.error));
+                                  },
+                                  [this](const QString &error) { emit redactionFailed(error); });
                                 return;
-                        } catch (const std::exception &) {
                         }
-                }
 
-                try {
-                        mtx::responses::EventId res = nlohmann::json::parse(data);
-                        emit redactionCompleted(room_id, event_id);
-                } catch (const std::exception &e) {
-                        emit redactionFailed(QString::fromStdString(e.what()));
-                }
-        });
+                        responseDecoder_->run<mtx::responses::EventId>(
+                          "redactions",
+                          [data]() { return nlohmann::json::parse(data.data()); },
+                          [this, room_id, event_id](mtx::responses::EventId &) {
+                                  emit redactionCompleted(room_id, event_id);
+                          },
+                          [this](const QString &error) { emit redactionFailed(error); });
+                });
+
+                return reply;
+        };
+
+        scheduler_->enqueue(RequestPriority::Send, room_id, start);
 }
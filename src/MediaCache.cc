@@ -0,0 +1,354 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QtConcurrent>
+
+#include "LmdbUtils.h"
+#include "MediaCache.h"
+
+static constexpr const char *DATA_DB = "data";
+static constexpr const char *META_DB = "meta";
+static constexpr const char *LRU_DB  = "lru";
+
+//! Extra space of the memory map for the LMDB bookkeeping.
+static constexpr uint64_t MAP_SIZE_OVERHEAD = 16UL * 1024UL * 1024UL; /* 16 MB */
+
+//! The entries are ordered by their access time, oldest first.
+static std::string
+lruKey(uint64_t access_time, const std::string &url)
+{
+        std::string key;
+        key.reserve(sizeof(access_time) + url.size());
+
+        appendKeyUint64BE(key, access_time);
+        key.append(url);
+
+        return key;
+}
+
+static std::string
+encodeMeta(uint64_t size, uint64_t access_time)
+{
+        std::string meta;
+        meta.reserve(2 * sizeof(uint64_t));
+
+        appendKeyUint64BE(meta, size);
+        appendKeyUint64BE(meta, access_time);
+
+        return meta;
+}
+
+static bool
+decodeMeta(const lmdb::val &meta, uint64_t &size, uint64_t &access_time)
+{
+        if (meta.size() != 2 * sizeof(uint64_t))
+                return false;
+
+        size        = decodeKeyUint64BE(meta.data(), sizeof(uint64_t));
+        access_time = decodeKeyUint64BE(meta.data() + sizeof(uint64_t), sizeof(uint64_t));
+
+        return true;
+}
+
+static uint64_t
+currentTime()
+{
+        return static_cast<uint64_t>(QDateTime::currentMSecsSinceEpoch());
+}
+
+MediaCache::MediaCache(const QString &path, uint64_t limit)
+  : path_{path}
+  , env_{nullptr}
+  , dataDb_{0}
+  , metaDb_{0}
+  , lruDb_{0}
+  , limit_{limit}
+  , size_{0}
+  , hits_{0}
+  , misses_{0}
+  , evictions_{0}
+  , isEvicting_{false}
+{}
+
+MediaCache::~MediaCache() { eviction_.waitForFinished(); }
+
+void
+MediaCache::setup()
+{
+        if (!QDir().mkpath(path_))
+                throw std::runtime_error(
+                  ("Unable to create media directory:" + path_).toStdString().c_str());
+
+        env_ = lmdb::env::create();
+        env_.set_mapsize(2 * limit_ + MAP_SIZE_OVERHEAD);
+        env_.set_max_dbs(3UL);
+        env_.open(path_.toStdString().c_str(), MDB_NOTLS);
+
+        auto txn = lmdb::txn::begin(env_);
+        dataDb_  = lmdb::dbi::open(txn, DATA_DB, MDB_CREATE);
+        metaDb_  = lmdb::dbi::open(txn, META_DB, MDB_CREATE);
+        lruDb_   = lmdb::dbi::open(txn, LRU_DB, MDB_CREATE);
+
+        uint64_t size = 0;
+
+        auto cursor = lmdb::cursor::open(txn, metaDb_);
+        lmdb::val url, meta;
+        while (cursor.get(url, meta, MDB_NEXT)) {
+                uint64_t entry_size = 0, access_time = 0;
+
+                if (decodeMeta(meta, entry_size, access_time))
+                        size += entry_size;
+        }
+        cursor.close();
+
+        txn.commit();
+
+        size_ = size;
+
+        qDebug() << "media cache:" << size << "bytes of" << limit_;
+
+        // The limit might have been lowered since the last run.
+        scheduleEviction();
+}
+
+QByteArray
+MediaCache::image(const QString &url)
+{
+        if (url.isEmpty())
+                return QByteArray();
+
+        const auto key = url.toStdString();
+
+        try {
+                ReadSnapshot snapshot(readers_, env_);
+
+                lmdb::val data;
+                bool res = lmdb::dbi_get(snapshot.txn(), dataDb_, lmdb::val(key), data);
+
+                QByteArray image;
+                if (res)
+                        image = QByteArray(data.data(), data.size());
+
+                if (!res) {
+                        misses_++;
+                        return QByteArray();
+                }
+
+                hits_++;
+
+                std::lock_guard<std::mutex> lock(accessMutex_);
+                pendingAccess_[key] = currentTime();
+
+                return image;
+        } catch (const lmdb::error &e) {
+                qCritical() << "image:" << e.what() << url;
+        }
+
+        return QByteArray();
+}
+
+void
+MediaCache::saveImage(const QString &url, const QByteArray &data)
+{
+        if (url.isEmpty())
+                return;
+
+        const auto key = url.toStdString();
+
+        try {
+                put(key, data);
+        } catch (const lmdb::map_full_error &) {
+                qWarning() << "media cache is full, evicting old entries";
+
+                try {
+                        evict();
+                        put(key, data);
+                } catch (const lmdb::error &e) {
+                        qCritical() << "saveImage:" << e.what();
+                }
+        } catch (const lmdb::error &e) {
+                qCritical() << "saveImage:" << e.what();
+        }
+
+        scheduleEviction();
+}
+
+void
+MediaCache::put(const std::string &url, const QByteArray &data)
+{
+        auto txn = lmdb::txn::begin(env_);
+
+        const auto accesses = flushAccessTimes(txn);
+
+        uint64_t prev_size = 0;
+
+        // Replace the previous entry.
+        lmdb::val meta;
+        if (lmdb::dbi_get(txn, metaDb_, lmdb::val(url), meta)) {
+                uint64_t access_time = 0;
+
+                if (decodeMeta(meta, prev_size, access_time))
+                        lmdb::dbi_del(txn, lruDb_, lmdb::val(lruKey(access_time, url)), nullptr);
+        }
+
+        const auto now = currentTime();
+
+        lmdb::dbi_put(txn, dataDb_, lmdb::val(url), lmdb::val(data.data(), data.size()));
+        lmdb::dbi_put(txn, metaDb_, lmdb::val(url), lmdb::val(encodeMeta(data.size(), now)));
+        lmdb::dbi_put(txn, lruDb_, lmdb::val(lruKey(now, url)), lmdb::val(""));
+
+        txn.commit();
+
+        clearAccessTimes(accesses);
+
+        size_ += data.size();
+        size_ -= prev_size;
+}
+
+std::map<std::string, uint64_t>
+MediaCache::flushAccessTimes(lmdb::txn &txn)
+{
+        std::map<std::string, uint64_t> accesses;
+
+        {
+                std::lock_guard<std::mutex> lock(accessMutex_);
+                accesses = pendingAccess_;
+        }
+
+        for (const auto &access : accesses) {
+                const auto &url = access.first;
+
+                lmdb::val meta;
+                if (!lmdb::dbi_get(txn, metaDb_, lmdb::val(url), meta))
+                        continue;
+
+                uint64_t size = 0, access_time = 0;
+                if (!decodeMeta(meta, size, access_time) || access_time >= access.second)
+                        continue;
+
+                lmdb::dbi_del(txn, lruDb_, lmdb::val(lruKey(access_time, url)), nullptr);
+                lmdb::dbi_put(txn, lruDb_, lmdb::val(lruKey(access.second, url)), lmdb::val(""));
+                lmdb::dbi_put(
+                  txn, metaDb_, lmdb::val(url), lmdb::val(encodeMeta(size, access.second)));
+        }
+
+        return accesses;
+}
+
+void
+MediaCache::clearAccessTimes(const std::map<std::string, uint64_t> &flushed)
+{
+        std::lock_guard<std::mutex> lock(accessMutex_);
+
+        for (const auto &access : flushed) {
+                auto it = pendingAccess_.find(access.first);
+
+                // Keep the lookups made since the flush.
+                if (it != pendingAccess_.end() && it->second <= access.second)
+                        pendingAccess_.erase(it);
+        }
+}
+
+void
+MediaCache::scheduleEviction()
+{
+        if (size_ <= limit_)
+                return;
+
+        bool expected = false;
+        if (!isEvicting_.compare_exchange_strong(expected, true))
+                return;
+
+        eviction_ = QtConcurrent::run([this]() {
+                try {
+                        evict();
+                } catch (const lmdb::error &e) {
+                        qWarning() << "media eviction failed:" << e.what();
+                }
+
+                isEvicting_ = false;
+        });
+}
+
+void
+MediaCache::evict()
+{
+        // Leave some room for new entries, so we don't evict on every save.
+        const uint64_t target = limit_ - limit_ / 10;
+
+        const uint64_t size = size_;
+        if (size <= target)
+                return;
+
+        const uint64_t excess = size - target;
+
+        auto txn = lmdb::txn::begin(env_);
+
+        const auto accesses = flushAccessTimes(txn);
+
+        uint64_t freed = 0;
+        std::vector<std::pair<std::string, std::string>> evicted;
+
+        auto cursor = lmdb::cursor::open(txn, lruDb_);
+
+        lmdb::val key, unused;
+        while (freed < excess && cursor.get(key, unused, MDB_NEXT)) {
+                if (key.size() < sizeof(uint64_t))
+                        continue;
+
+                std::string url(key.data() + sizeof(uint64_t), key.size() - sizeof(uint64_t));
+
+                lmdb::val meta;
+                uint64_t entry_size = 0, access_time = 0;
+
+                if (lmdb::dbi_get(txn, metaDb_, lmdb::val(url), meta) &&
+                    decodeMeta(meta, entry_size, access_time))
+                        freed += entry_size;
+
+                evicted.emplace_back(std::string(key.data(), key.size()), std::move(url));
+        }
+
+        cursor.close();
+
+        for (const auto &entry : evicted) {
+                lmdb::dbi_del(txn, lruDb_, lmdb::val(entry.first), nullptr);
+                lmdb::dbi_del(txn, metaDb_, lmdb::val(entry.second), nullptr);
+                lmdb::dbi_del(txn, dataDb_, lmdb::val(entry.second), nullptr);
+        }
+
+        txn.commit();
+
+        clearAccessTimes(accesses);
+
+        size_ -= std::min<uint64_t>(freed, size_);
+        evictions_ += evicted.size();
+
+        qDebug() << "media cache: evicted" << evicted.size() << "entries," << freed << "bytes";
+}
+
+MediaCache::Statistics
+MediaCache::statistics() const
+{
+        return Statistics{hits_, misses_, evictions_, size_, limit_};
+}
@@ -0,0 +1,346 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <QtConcurrent>
+
+#include "MemberDirectory.h"
+
+MemberDirectory::MemberDirectory()
+  : snapshot_{std::make_shared<const Snapshot>()}
+  , clock_{0}
+{}
+
+bool
+MemberDirectory::find(const QString &room_id, const QString &user_id, Member &member)
+{
+        auto current = snapshot();
+        auto room    = current->rooms.constFind(room_id);
+
+        if (room == current->rooms.constEnd()) {
+                // Reading a large room would stall the GUI thread.
+                requestLoad(room_id);
+                return false;
+        }
+
+        (*room)->lastUsed = ++clock_;
+
+        const auto it = (*room)->members.constFind(user_id);
+        if (it == (*room)->members.constEnd())
+                return false;
+
+        member = it.value();
+        return true;
+}
+
+QString
+MemberDirectory::displayName(const QString &room_id, const QString &user_id)
+{
+        Member member;
+        if (find(room_id, user_id, member))
+                return member.display_name;
+
+        return user_id;
+}
+
+QString
+MemberDirectory::avatarUrl(const QString &room_id, const QString &user_id)
+{
+        Member member;
+        if (find(room_id, user_id, member))
+                return member.avatar_url;
+
+        return QString();
+}
+
+void
+MemberDirectory::insert(const QString &room_id,
+                        const QString &user_id,
+                        const QString &display_name,
+                        const QString &avatar_url)
+{
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        auto &change   = pending_[room_id][user_id];
+        change.removed = false;
+        change.member  = Member{display_name, avatar_url};
+}
+
+void
+MemberDirectory::remove(const QString &room_id, const QString &user_id)
+{
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        auto &change   = pending_[room_id][user_id];
+        change.removed = true;
+        change.member  = Member{};
+}
+
+void
+MemberDirectory::commit()
+{
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        if (pending_.isEmpty())
+                return;
+
+        commits_ += 1;
+
+        // The unchanged rooms are shared with the previous snapshot.
+        auto next = std::make_shared<Snapshot>(*snapshot());
+
+        for (auto room = pending_.constBegin(); room != pending_.constEnd(); ++room) {
+                const auto current = next->rooms.constFind(room.key());
+                if (current == next->rooms.constEnd())
+                        continue;
+
+                auto updated      = std::make_shared<Room>((*current)->members);
+                updated->lastUsed = (*current)->lastUsed.load();
+
+                loadedMembers_ -= updated->members.size();
+
+                const auto &changes = room.value();
+                for (auto it = changes.constBegin(); it != changes.constEnd(); ++it) {
+                        if (it.value().removed) {
+                                updated->members.remove(it.key());
+                        } else {
+                                const auto &member = it.value().member;
+                                updated->members.insert(
+                                  intern(it.key()),
+                                  Member{intern(member.display_name), intern(member.avatar_url)});
+                        }
+                }
+
+                loadedMembers_ += updated->members.size();
+
+                next->rooms.insert(room.key(), std::move(updated));
+        }
+
+        pending_.clear();
+
+        if (evict(*next, QString()) || strings_.size() > 2 * std::max(liveStrings_, MIN_STRINGS))
+                releaseStrings(*next);
+
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(next)));
+}
+
+void
+MemberDirectory::discard()
+{
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        pending_.clear();
+}
+
+void
+MemberDirectory::clear()
+{
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        pending_.clear();
+        strings_.clear();
+        liveStrings_   = 0;
+        loadedMembers_ = 0;
+        commits_ += 1;
+
+        std::atomic_store(&snapshot_, std::make_shared<const Snapshot>());
+}
+
+void
+MemberDirectory::setLoader(RoomLoader roomLoader, LoadedHandler onLoaded)
+{
+        // Wait for the running loads, so the previous loader can be safely destroyed.
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        std::unique_lock<std::shared_timed_mutex> loaderLock(loaderMutex_);
+
+        roomLoader_ = std::move(roomLoader);
+        onLoaded_   = std::move(onLoaded);
+}
+
+void
+MemberDirectory::setLimit(std::size_t limit)
+{
+        std::lock_guard<std::mutex> lock(writeMutex_);
+
+        limit_ = limit;
+}
+
+void
+MemberDirectory::prefetch(const std::vector<QString> &room_ids)
+{
+        std::vector<QString> missing;
+
+        const auto current = snapshot();
+        for (const auto &room_id : room_ids) {
+                if (!current->rooms.contains(room_id))
+                        missing.push_back(room_id);
+        }
+
+        if (missing.empty())
+                return;
+
+        QtConcurrent::run([this, missing]() {
+                for (const auto &room_id : missing)
+                        load(room_id);
+        });
+}
+
+void
+MemberDirectory::requestLoad(const QString &room_id)
+{
+        {
+                std::shared_lock<std::shared_timed_mutex> loaderLock(loaderMutex_);
+
+                if (!roomLoader_)
+                        return;
+        }
+
+        {
+                std::lock_guard<std::mutex> lock(writeMutex_);
+
+                if (loading_.contains(room_id))
+                        return;
+
+                loading_.insert(room_id);
+        }
+
+        QtConcurrent::run([this, room_id]() {
+                load(room_id);
+
+                // A failed load is queued again by the next lookup.
+                std::lock_guard<std::mutex> lock(writeMutex_);
+                loading_.remove(room_id);
+        });
+}
+
+void
+MemberDirectory::load(const QString &room_id)
+{
+        // The cache is read without the write lock, since the writer thread takes
+        // the cache's lock first. If changes were published in the meantime, they
+        // might be missing from the read & the room is read again.
+        for (;;) {
+                uint64_t commits = 0;
+                {
+                        std::lock_guard<std::mutex> lock(writeMutex_);
+
+                        if (snapshot()->rooms.contains(room_id))
+                                return;
+
+                        commits = commits_;
+                }
+
+                Members members;
+                {
+                        std::shared_lock<std::shared_timed_mutex> loaderLock(loaderMutex_);
+
+                        // Nothing is kept on failure, so the next lookup tries again.
+                        if (!roomLoader_ || !roomLoader_(room_id, members))
+                                return;
+                }
+
+                std::lock_guard<std::mutex> lock(writeMutex_);
+
+                if (snapshot()->rooms.contains(room_id))
+                        return;
+
+                if (commits != commits_)
+                        continue;
+
+                auto room      = std::make_shared<Room>();
+                room->lastUsed = ++clock_;
+
+                for (auto it = members.constBegin(); it != members.constEnd(); ++it) {
+                        room->members.insert(
+                          intern(it.key()),
+                          Member{intern(it.value().display_name), intern(it.value().avatar_url)});
+                }
+
+                loadedMembers_ += room->members.size();
+
+                auto next = std::make_shared<Snapshot>(*snapshot());
+                next->rooms.insert(intern(room_id), std::move(room));
+
+                if (evict(*next, room_id))
+                        releaseStrings(*next);
+
+                std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(next)));
+
+                break;
+        }
+
+        // Without the write lock, since the handler might look up the members.
+        std::shared_lock<std::shared_timed_mutex> loaderLock(loaderMutex_);
+
+        if (onLoaded_)
+                onLoaded_(room_id);
+}
+
+bool
+MemberDirectory::evict(Snapshot &snapshot, const QString &keep)
+{
+        bool evicted = false;
+
+        while (loadedMembers_ > limit_ && snapshot.rooms.size() > 1) {
+                auto oldest = snapshot.rooms.end();
+
+                for (auto it = snapshot.rooms.begin(); it != snapshot.rooms.end(); ++it) {
+                        if (it.key() == keep)
+                                continue;
+
+                        if (oldest == snapshot.rooms.end() ||
+                            it.value()->lastUsed < oldest.value()->lastUsed)
+                                oldest = it;
+                }
+
+                if (oldest == snapshot.rooms.end())
+                        break;
+
+                loadedMembers_ -= oldest.value()->members.size();
+                snapshot.rooms.erase(oldest);
+
+                evicted = true;
+        }
+
+        return evicted;
+}
+
+void
+MemberDirectory::releaseStrings(const Snapshot &snapshot)
+{
+        QSet<QString> strings;
+        for (auto room = snapshot.rooms.constBegin(); room != snapshot.rooms.constEnd(); ++room) {
+                strings.insert(room.key());
+
+                const auto &members = room.value()->members;
+                for (auto it = members.constBegin(); it != members.constEnd(); ++it) {
+                        strings.insert(it.key());
+                        strings.insert(it.value().display_name);
+                        strings.insert(it.value().avatar_url);
+                }
+        }
+
+        strings_.swap(strings);
+        liveStrings_ = strings_.size();
+}
+
+QString
+MemberDirectory::intern(const QString &str)
+{
+        return *strings_.insert(str);
+}
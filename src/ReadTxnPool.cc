@@ -0,0 +1,74 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ReadTxnPool.h"
+
+ReadTxnPool::ReadTxnPool(std::size_t capacity)
+  : capacity_{capacity}
+{}
+
+lmdb::txn
+ReadTxnPool::acquire(MDB_env *env)
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                if (!idle_.empty()) {
+                        auto txn = std::move(idle_.back());
+                        idle_.pop_back();
+
+                        txn.renew();
+                        return txn;
+                }
+        }
+
+        return lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+}
+
+void
+ReadTxnPool::release(lmdb::txn &&txn)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // The transaction is aborted when it goes out of scope.
+        if (idle_.size() >= capacity_)
+                return;
+
+        txn.reset();
+        idle_.push_back(std::move(txn));
+}
+
+void
+ReadTxnPool::clear()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        idle_.clear();
+}
+
+ReadSnapshot::ReadSnapshot(ReadTxnPool &pool, MDB_env *env, Lock lock)
+  : lock_{std::move(lock)}
+  , pool_{&pool}
+  , txn_{pool.acquire(env)}
+{}
+
+ReadSnapshot::~ReadSnapshot()
+{
+        // Moved-from snapshots have no transaction.
+        if (txn_.handle() != nullptr)
+                pool_->release(std::move(txn_));
+}
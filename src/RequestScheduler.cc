@@ -0,0 +1,193 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include <QNetworkReply>
+#include <QSharedPointer>
+
+#include "RequestScheduler.h"
+
+static int
+index(RequestPriority priority)
+{
+        return static_cast<int>(priority);
+}
+
+static int
+limit(RequestPriority priority)
+{
+        switch (priority) {
+        case RequestPriority::Send:
+                return MAX_SEND_REQUESTS;
+        case RequestPriority::Sync:
+                return MAX_SYNC_REQUESTS;
+        case RequestPriority::Pagination:
+                return MAX_PAGINATION_REQUESTS;
+        case RequestPriority::Media:
+                return MAX_MEDIA_REQUESTS;
+        case RequestPriority::Prefetch:
+                return MAX_PREFETCH_REQUESTS;
+        }
+
+        return 1;
+}
+
+static bool
+isBackground(RequestPriority priority)
+{
+        return priority != RequestPriority::Send && priority != RequestPriority::Sync;
+}
+
+RequestScheduler::RequestScheduler(QObject *parent)
+  : QObject(parent)
+{}
+
+RequestPriority
+RequestScheduler::effectivePriority(const Job &job) const
+{
+        const bool dependsOnVisibility = job.priority == RequestPriority::Pagination ||
+                                         job.priority == RequestPriority::Media;
+
+        if (dependsOnVisibility && !job.room_id.isEmpty() && job.room_id != visibleRoom_)
+                return RequestPriority::Prefetch;
+
+        return job.priority;
+}
+
+void
+RequestScheduler::enqueue(RequestPriority priority, const QString &room_id, Request start)
+{
+        Job job{priority, room_id, std::move(start)};
+
+        queues_[index(effectivePriority(job))].push_back(std::move(job));
+
+        pump();
+}
+
+void
+RequestScheduler::setVisibleRoom(const QString &room_id)
+{
+        if (room_id == visibleRoom_)
+                return;
+
+        visibleRoom_ = room_id;
+
+        std::deque<Job> jobs;
+
+        for (auto priority : {RequestPriority::Pagination,
+                              RequestPriority::Media,
+                              RequestPriority::Prefetch}) {
+                auto &queue = queues_[index(priority)];
+
+                std::move(queue.begin(), queue.end(), std::back_inserter(jobs));
+                queue.clear();
+        }
+
+        // The requests of the room that was just opened go first; the rest
+        // keep their order.
+        std::stable_partition(jobs.begin(), jobs.end(), [&room_id](const Job &job) {
+                return !job.room_id.isEmpty() && job.room_id == room_id;
+        });
+
+        for (auto &job : jobs)
+                queues_[index(effectivePriority(job))].push_back(std::move(job));
+
+        pump();
+}
+
+void
+RequestScheduler::clear()
+{
+        for (auto &queue : queues_)
+                queue.clear();
+
+        // The running requests no longer take a slot.
+        active_.fill(0);
+        generation_ += 1;
+
+        visibleRoom_.clear();
+}
+
+void
+RequestScheduler::pump()
+{
+        int background = 0;
+        for (int i = 0; i < REQUEST_PRIORITIES; ++i) {
+                if (isBackground(static_cast<RequestPriority>(i)))
+                        background += active_[i];
+        }
+
+        for (int i = 0; i < REQUEST_PRIORITIES; ++i) {
+                const auto priority = static_cast<RequestPriority>(i);
+                auto &queue         = queues_[i];
+
+                while (!queue.empty() && active_[i] < limit(priority)) {
+                        // The classes that follow are background too.
+                        if (isBackground(priority) && background >= MAX_BACKGROUND_REQUESTS)
+                                return;
+
+                        auto job = std::move(queue.front());
+                        queue.pop_front();
+
+                        auto reply = job.start();
+
+                        if (!reply)
+                                continue;
+
+                        active_[i] += 1;
+                        if (isBackground(priority))
+                                background += 1;
+
+                        // The slot is freed once, when the reply finishes or when
+                        // it's destroyed without finishing, e.g after an abort.
+                        auto released = QSharedPointer<bool>(new bool(false));
+                        auto release  = [this, i, released, generation = generation_]() {
+                                if (*released || generation != generation_)
+                                        return;
+
+                                *released = true;
+
+                                active_[i] -= 1;
+                                finished_[i] += 1;
+
+                                pump();
+                        };
+
+                        connect(reply, &QNetworkReply::finished, this, release);
+                        connect(reply, &QObject::destroyed, this, release);
+                }
+        }
+}
+
+int
+RequestScheduler::queueDepth(RequestPriority priority) const
+{
+        return static_cast<int>(queues_[index(priority)].size());
+}
+
+std::array<RequestScheduler::Statistics, REQUEST_PRIORITIES>
+RequestScheduler::statistics() const
+{
+        std::array<Statistics, REQUEST_PRIORITIES> stats;
+
+        for (int i = 0; i < REQUEST_PRIORITIES; ++i)
+                stats[i] = {static_cast<int>(queues_[i].size()), active_[i], finished_[i]};
+
+        return stats;
+}
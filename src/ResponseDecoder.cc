@@ -0,0 +1,79 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <QtConcurrent>
+
+#include "ResponseDecoder.h"
+
+ResponseDecoder::ResponseDecoder(QObject *parent)
+  : QObject(parent)
+{
+        pool_.setMaxThreadCount(DECODER_THREADS);
+
+        connect(this,
+                &ResponseDecoder::decoded,
+                this,
+                &ResponseDecoder::deliver,
+                Qt::QueuedConnection);
+}
+
+ResponseDecoder::~ResponseDecoder()
+{
+        // The jobs refer to this instance.
+        pool_.waitForDone();
+}
+
+void
+ResponseDecoder::submit(const QString &queue,
+                        std::shared_ptr<Job> job,
+                        std::function<void()> decode)
+{
+        queues_[queue].push_back(job);
+
+        QtConcurrent::run(&pool_, [this, job, decode]() {
+                decode();
+
+                job->done = true;
+                emit decoded();
+        });
+}
+
+void
+ResponseDecoder::deliver()
+{
+        std::vector<std::function<void()>> ready;
+
+        for (auto queue = queues_.begin(); queue != queues_.end();) {
+                auto &jobs = queue->second;
+
+                while (!jobs.empty() && jobs.front()->done) {
+                        ready.push_back(std::move(jobs.front()->handle));
+                        jobs.pop_front();
+                }
+
+                if (jobs.empty())
+                        queue = queues_.erase(queue);
+                else
+                        ++queue;
+        }
+
+        // The handlers might submit new jobs.
+        for (const auto &handle : ready)
+                handle();
+}
@@ -18,6 +18,7 @@
 #include <QBuffer>
 #include <QDebug>
 #include <QObject>
+#include <QScrollBar>
 #include <QTimer>
 
 #include "Cache.h"
@@ -27,6 +28,10 @@
 #include "RoomInfoListItem.h"
 #include "RoomList.h"
 #include "UserSettingsPage.h"
+#include "Utils.h"
+
+//! How long to wait after scrolling before loading the members of the visible rooms.
+constexpr int MEMBER_PREFETCH_DELAY = 300;
 
 RoomList::RoomList(QSharedPointer<MatrixClient> client,
                    QSharedPointer<UserSettings> userSettings,
@@ -57,6 +62,15 @@ RoomList::RoomList(QSharedPointer<MatrixClient> client,
         scrollArea_->setWidget(scrollAreaContents_);
         topLayout_->addWidget(scrollArea_);
 
+        prefetchTimer_ = new QTimer(this);
+        prefetchTimer_->setSingleShot(true);
+        prefetchTimer_->setInterval(MEMBER_PREFETCH_DELAY);
+        connect(prefetchTimer_, &QTimer::timeout, this, &RoomList::prefetchVisibleRooms);
+        connect(scrollArea_->verticalScrollBar(),
+                &QScrollBar::valueChanged,
+                prefetchTimer_,
+                static_cast<void (QTimer::*)()>(&QTimer::start));
+
         connect(client_.data(),
                 &MatrixClient::roomAvatarRetrieved,
                 this,
@@ -137,6 +151,9 @@ RoomList::updateUnreadMessageCount(const QString &roomid, int count)
                 return;
         }
 
+        if (!cache_.isNull() && rooms_[roomid]->unreadMessageCount() != count)
+                cache_->saveUnreadCount(roomid.toStdString(), count);
+
         rooms_[roomid]->updateUnreadMessageCount(count);
 
         calculateUnreadMessageCount();
@@ -172,6 +189,15 @@ RoomList::initialize(const QMap<QString, RoomInfo> &info)
         if (rooms_.empty())
                 return;
 
+        // Paint the list as it was left, without waiting for the timelines.
+        if (!cache_.isNull()) {
+                restoreEntries(cache_->roomListEntries());
+                sortRoomsByLastMessage();
+        }
+
+        // Wait for the layout before checking which rooms are visible.
+        prefetchTimer_->start();
+
         auto room = firstRoom();
         if (room.second.isNull())
                 return;
@@ -180,6 +206,32 @@ RoomList::initialize(const QMap<QString, RoomInfo> &info)
         emit roomChanged(room.first);
 }
 
+void
+RoomList::restoreEntries(const std::map<QString, RoomListEntry> &entries)
+{
+        for (const auto &entry : entries) {
+                if (!roomExists(entry.first) || rooms_[entry.first].isNull())
+                        continue;
+
+                auto room = rooms_[entry.first];
+
+                if (entry.second.timestamp != 0) {
+                        const auto ts = QDateTime::fromMSecsSinceEpoch(entry.second.timestamp);
+
+                        room->setDescriptionMessage(
+                          DescInfo{QString::fromStdString(entry.second.username),
+                                   QString::fromStdString(entry.second.user_id),
+                                   QString::fromStdString(entry.second.body),
+                                   utils::descriptiveTime(ts),
+                                   ts});
+                }
+
+                room->updateUnreadMessageCount(entry.second.unread_count);
+        }
+
+        calculateUnreadMessageCount();
+}
+
 void
 RoomList::cleanupInvites(const std::map<QString, bool> &invites)
 {
@@ -249,8 +301,24 @@ RoomList::updateRoomDescription(const QString &roomid, const DescInfo &info)
                 return;
         }
 
+        const auto previous = rooms_[roomid]->lastMessageInfo();
+
         rooms_[roomid]->setDescriptionMessage(info);
 
+        // The restored message is repeated when the timeline is loaded.
+        const bool isNewMessage = previous.userid != info.userid ||
+                                  previous.datetime != info.datetime || previous.body != info.body;
+
+        if (!cache_.isNull() && isNewMessage) {
+                RoomListEntry entry;
+                entry.user_id   = info.userid.toStdString();
+                entry.username  = info.username.toStdString();
+                entry.body      = info.body.toStdString();
+                entry.timestamp = info.datetime.toMSecsSinceEpoch();
+
+                cache_->saveLastMessage(roomid.toStdString(), entry);
+        }
+
         if (underMouse()) {
                 // When the user hover out of the roomlist a sort will be triggered.
                 isSortPending_ = true;
@@ -296,6 +364,24 @@ RoomList::sortRoomsByLastMessage()
                 contentsLayout_->removeWidget(roomWidget);
                 contentsLayout_->insertWidget(newIndex, roomWidget);
         }
+
+        prefetchTimer_->start();
+}
+
+void
+RoomList::prefetchVisibleRooms()
+{
+        std::vector<QString> visible;
+
+        for (const auto &room : rooms_) {
+                if (room.second.isNull() || room.second->isInvite())
+                        continue;
+
+                if (room.second->isVisible() && !room.second->visibleRegion().isEmpty())
+                        visible.push_back(room.first);
+        }
+
+        Cache::Members.prefetch(visible);
 }
 
 void
@@ -0,0 +1,545 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include <QDebug>
+
+#include "LmdbUtils.h"
+#include "SearchIndex.h"
+
+static constexpr const char *DOCUMENTS_DB = "search_documents";
+static constexpr const char *POSTINGS_DB  = "search_postings";
+static constexpr const char *TERMS_DB     = "search_terms";
+
+//! Shorter words are too common to be useful.
+static constexpr int MIN_TERM_LENGTH = 2;
+//! Longer words are most likely links or encoded data.
+static constexpr int MAX_TERM_LENGTH = 64;
+
+//! Upper bound of the postings read by a search, so queries made only of
+//! common words stay fast. It's shared by the rooms that are searched ...
+static constexpr std::size_t MAX_CANDIDATES = 20000;
+//! ... but every room gets to read at least this many.
+static constexpr std::size_t MIN_ROOM_CANDIDATES = 200;
+
+//! Upper bound of the indexed terms that a prefix expands to.
+static constexpr std::size_t MAX_PREFIX_TERMS = 16;
+
+//! Characters of context shown on each side of the first match.
+static constexpr int SNIPPET_CONTEXT = 40;
+
+//! The message fields kept for the results.
+struct Document
+{
+        uint64_t timestamp = 0;
+        std::string sender;
+        std::string body;
+};
+
+static std::string
+encodeDocument(const Document &doc)
+{
+        return encodeKeyUint64BE(doc.timestamp) + doc.sender + '\0' + doc.body;
+}
+
+static bool
+decodeDocument(const lmdb::val &data, Document &doc)
+{
+        if (data.size() < sizeof(uint64_t))
+                return false;
+
+        const std::string rest(data.data() + sizeof(uint64_t), data.size() - sizeof(uint64_t));
+        const auto separator = rest.find('\0');
+
+        if (separator == std::string::npos)
+                return false;
+
+        doc.timestamp = decodeKeyUint64BE(data.data(), sizeof(uint64_t));
+        doc.sender    = rest.substr(0, separator);
+        doc.body      = rest.substr(separator + 1);
+
+        return true;
+}
+
+//! The part of the posting keys that identifies the message. The timestamp
+//! keeps the posting lists of the rooms in chronological order.
+static std::string
+postingSuffix(const std::string &room_id, uint64_t timestamp, const std::string &event_id)
+{
+        return room_id + '\0' + encodeKeyUint64BE(timestamp) + event_id;
+}
+
+//! The text around the first occurrence of the terms.
+static QString
+snippet(const QString &body, const std::vector<std::string> &terms)
+{
+        int first  = -1;
+        int length = 0;
+
+        for (const auto &term : terms) {
+                const auto t   = QString::fromStdString(term);
+                const auto pos = body.indexOf(t, 0, Qt::CaseInsensitive);
+
+                if (pos >= 0 && (first < 0 || pos < first)) {
+                        first  = pos;
+                        length = t.size();
+                }
+        }
+
+        first = std::max(first, 0);
+
+        const int start = std::max(first - SNIPPET_CONTEXT, 0);
+        const int end   = std::min(first + length + SNIPPET_CONTEXT, body.size());
+
+        auto text = body.mid(start, end - start).simplified();
+
+        if (start > 0)
+                text.prepend(QChar(0x2026));
+        if (end < body.size())
+                text.append(QChar(0x2026));
+
+        return text;
+}
+
+SearchIndex::SearchIndex()
+  : documentsDb_{0}
+  , postingsDb_{0}
+  , termsDb_{0}
+{}
+
+void
+SearchIndex::open(lmdb::txn &txn)
+{
+        documentsDb_ = lmdb::dbi::open(txn, DOCUMENTS_DB, MDB_CREATE);
+        postingsDb_  = lmdb::dbi::open(txn, POSTINGS_DB, MDB_CREATE);
+        termsDb_     = lmdb::dbi::open(txn, TERMS_DB, MDB_CREATE);
+}
+
+std::vector<std::pair<const char *, MDB_dbi>>
+SearchIndex::databases() const
+{
+        return {{DOCUMENTS_DB, documentsDb_.handle()},
+                {POSTINGS_DB, postingsDb_.handle()},
+                {TERMS_DB, termsDb_.handle()}};
+}
+
+std::vector<std::string>
+SearchIndex::tokenize(const QString &text)
+{
+        std::vector<std::string> terms;
+
+        const auto folded = text.toCaseFolded();
+
+        int start = -1;
+        for (int i = 0; i <= folded.size(); ++i) {
+                const bool inWord = i < folded.size() &&
+                                    (folded.at(i).isLetterOrNumber() || folded.at(i).isMark());
+
+                if (inWord) {
+                        if (start < 0)
+                                start = i;
+                        continue;
+                }
+
+                if (start < 0)
+                        continue;
+
+                const int length = i - start;
+                if (length >= MIN_TERM_LENGTH && length <= MAX_TERM_LENGTH)
+                        terms.emplace_back(folded.mid(start, length).toStdString());
+
+                start = -1;
+        }
+
+        return terms;
+}
+
+void
+SearchIndex::add(lmdb::txn &txn, const std::string &room_id, const nlohmann::json &event)
+{
+        std::string event_id;
+        Document doc;
+
+        try {
+                const auto type = event.at("type").get<std::string>();
+
+                if (type == "m.room.redaction") {
+                        remove(txn, room_id, event.at("redacts").get<std::string>());
+                        return;
+                }
+
+                if (type != "m.room.message")
+                        return;
+
+                const auto &content = event.at("content");
+                const auto msgtype  = content.at("msgtype").get<std::string>();
+
+                // The body of the other messages is only a file name.
+                if (msgtype != "m.text" && msgtype != "m.notice" && msgtype != "m.emote")
+                        return;
+
+                event_id      = event.at("event_id").get<std::string>();
+                doc.sender    = event.at("sender").get<std::string>();
+                doc.timestamp = event.at("origin_server_ts").get<uint64_t>();
+                doc.body      = content.at("body").get<std::string>();
+        } catch (const nlohmann::json::exception &e) {
+                qWarning() << "failed to index event:" << e.what();
+                return;
+        }
+
+        const auto key = room_id + '\0' + event_id;
+
+        // The same events are received again after a gap in the timeline.
+        lmdb::val unused;
+        if (lmdb::dbi_get(txn, documentsDb_, lmdb::val(key), unused))
+                return;
+
+        lmdb::dbi_put(txn, documentsDb_, lmdb::val(key), lmdb::val(encodeDocument(doc)));
+
+        updatePostings(txn,
+                       postingSuffix(room_id, doc.timestamp, event_id),
+                       QString::fromStdString(doc.body),
+                       false);
+}
+
+void
+SearchIndex::remove(lmdb::txn &txn, const std::string &room_id, const std::string &event_id)
+{
+        const auto key = room_id + '\0' + event_id;
+
+        lmdb::val data;
+        if (!lmdb::dbi_get(txn, documentsDb_, lmdb::val(key), data))
+                return;
+
+        Document doc;
+        if (decodeDocument(data, doc))
+                updatePostings(txn,
+                               postingSuffix(room_id, doc.timestamp, event_id),
+                               QString::fromStdString(doc.body),
+                               true);
+
+        lmdb::dbi_del(txn, documentsDb_, lmdb::val(key), nullptr);
+}
+
+void
+SearchIndex::removeRoom(lmdb::txn &txn, const std::string &room_id)
+{
+        const auto prefix = room_id + '\0';
+
+        std::vector<std::string> event_ids;
+
+        {
+                auto cursor = lmdb::cursor::open(txn, documentsDb_);
+
+                lmdb::val key(prefix), unused;
+                bool found = cursor.get(key, unused, MDB_SET_RANGE);
+
+                while (found && hasPrefix(key, prefix)) {
+                        event_ids.emplace_back(key.data() + prefix.size(),
+                                               key.size() - prefix.size());
+                        found = cursor.get(key, unused, MDB_NEXT);
+                }
+
+                cursor.close();
+        }
+
+        for (const auto &event_id : event_ids)
+                remove(txn, room_id, event_id);
+}
+
+void
+SearchIndex::updatePostings(lmdb::txn &txn,
+                            const std::string &document,
+                            const QString &body,
+                            bool removed)
+{
+        std::map<std::string, uint64_t> frequencies;
+        for (auto &term : tokenize(body))
+                ++frequencies[std::move(term)];
+
+        for (const auto &entry : frequencies) {
+                const auto &term = entry.first;
+                const auto key   = term + '\0' + document;
+
+                if (removed) {
+                        if (!lmdb::dbi_del(txn, postingsDb_, lmdb::val(key), nullptr))
+                                continue;
+                } else {
+                        const auto tf = std::min<uint64_t>(entry.second, UINT8_MAX);
+                        lmdb::dbi_put(txn,
+                                      postingsDb_,
+                                      lmdb::val(key),
+                                      lmdb::val(std::string(1, static_cast<char>(tf))));
+                }
+
+                lmdb::val data;
+                uint64_t count = 0;
+
+                if (lmdb::dbi_get(txn, termsDb_, lmdb::val(term), data))
+                        count = decodeKeyUint64BE(data.data(), data.size());
+
+                count = removed ? (count > 0 ? count - 1 : 0) : count + 1;
+
+                if (count == 0)
+                        lmdb::dbi_del(txn, termsDb_, lmdb::val(term), nullptr);
+                else
+                        lmdb::dbi_put(
+                          txn, termsDb_, lmdb::val(term), lmdb::val(encodeKeyUint64BE(count)));
+        }
+}
+
+std::vector<MessageSearchResult>
+SearchIndex::search(lmdb::txn &txn,
+                    const QString &query,
+                    const std::string &room_id,
+                    std::size_t limit)
+{
+        struct Term
+        {
+                std::string term;
+                uint64_t count;
+                double weight;
+        };
+
+        //! The indexed terms that match a word of the query.
+        struct Word
+        {
+                std::vector<Term> terms;
+                uint64_t count = 0;
+        };
+
+        struct Candidate
+        {
+                std::string document;
+                double score;
+                uint64_t timestamp;
+        };
+
+        auto tokens = tokenize(query);
+
+        // The last word might still be typed, so it matches as a prefix.
+        std::string prefix;
+        if (!tokens.empty()) {
+                const auto folded = query.toCaseFolded();
+                const auto last   = QString::fromStdString(tokens.back());
+
+                if (folded.endsWith(last))
+                        prefix = tokens.back();
+        }
+
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+        if (tokens.empty() || limit == 0)
+                return {};
+
+        MDB_stat stat;
+        lmdb::dbi_stat(txn, documentsDb_.handle(), &stat);
+
+        const double total = static_cast<double>(stat.ms_entries);
+
+        auto terms = lmdb::cursor::open(txn, termsDb_);
+
+        std::vector<Word> words;
+        for (const auto &token : tokens) {
+                Word word;
+
+                lmdb::val key(token), data;
+                bool found = terms.get(key, data, MDB_SET_RANGE);
+
+                for (; found && hasPrefix(key, token) && word.terms.size() < MAX_PREFIX_TERMS;
+                     found = terms.get(key, data, MDB_NEXT)) {
+                        const std::string term(key.data(), key.size());
+
+                        if (token != prefix && term != token)
+                                break;
+
+                        const auto count  = decodeKeyUint64BE(data.data(), data.size());
+                        const auto weight = std::log(1.0 + total / std::max<uint64_t>(count, 1));
+
+                        word.terms.push_back(Term{term, count, weight});
+                        word.count += count;
+                }
+
+                // Every word has to match.
+                if (word.terms.empty())
+                        return {};
+
+                words.push_back(std::move(word));
+        }
+
+        terms.close();
+
+        // Walk the shortest posting lists & look up the others.
+        std::sort(words.begin(), words.end(), [](const Word &a, const Word &b) {
+                return a.count < b.count;
+        });
+
+        // TF-IDF with a dampened term frequency.
+        const auto score = [](const lmdb::val &tf, const Term &term) {
+                const int frequency = tf.size() > 0 ? static_cast<uint8_t>(tf.data()[0]) : 1;
+                return (1.0 + std::log(frequency)) * term.weight;
+        };
+
+        // The same message can contain more than one term of the prefix.
+        std::map<std::string, Candidate> candidates;
+
+        auto cursor = lmdb::cursor::open(txn, postingsDb_);
+
+        for (const auto &term : words.front().terms) {
+                const auto termPrefix = term.term + '\0';
+
+                // The rooms that have postings for the term.
+                std::vector<std::string> rooms;
+                if (!room_id.empty()) {
+                        rooms.push_back(room_id);
+                } else {
+                        lmdb::val key(termPrefix), value;
+                        bool found = cursor.get(key, value, MDB_SET_RANGE);
+
+                        while (found && hasPrefix(key, termPrefix)) {
+                                const std::string rest(key.data() + termPrefix.size(),
+                                                       key.size() - termPrefix.size());
+                                const auto room = rest.substr(0, rest.find('\0'));
+
+                                rooms.push_back(room);
+
+                                // Skip to the first posting of the next room.
+                                const auto next = termPrefix + room + '\x01';
+
+                                key   = lmdb::val(next);
+                                found = cursor.get(key, value, MDB_SET_RANGE);
+                        }
+                }
+
+                const auto lists  = rooms.size() * words.front().terms.size();
+                const auto budget = std::max(MAX_CANDIDATES / std::max<std::size_t>(lists, 1),
+                                             MIN_ROOM_CANDIDATES);
+
+                // The postings of each room are read from the most recent.
+                for (const auto &room : rooms) {
+                        const auto roomPrefix = termPrefix + room + '\0';
+                        const auto upper      = roomPrefix + encodeKeyUint64BE(UINT64_MAX);
+
+                        lmdb::val key(upper), value;
+                        bool found = cursor.get(key, value, MDB_SET_RANGE)
+                                       ? cursor.get(key, value, MDB_PREV)
+                                       : cursor.get(key, value, MDB_LAST);
+
+                        for (std::size_t scanned = 0;
+                             found && hasPrefix(key, roomPrefix) && scanned < budget;
+                             ++scanned, found = cursor.get(key, value, MDB_PREV)) {
+                                const std::string document(key.data() + termPrefix.size(),
+                                                           key.size() - termPrefix.size());
+
+                                const auto separator = document.find('\0');
+                                if (separator == std::string::npos ||
+                                    document.size() < separator + 1 + sizeof(uint64_t))
+                                        continue;
+
+                                const auto tf = score(value, term);
+
+                                auto it = candidates.find(document);
+                                if (it != candidates.end()) {
+                                        it->second.score = std::max(it->second.score, tf);
+                                        continue;
+                                }
+
+                                const auto time = document.data() + separator + 1;
+
+                                Candidate candidate;
+                                candidate.document  = document;
+                                candidate.score     = tf;
+                                candidate.timestamp = decodeKeyUint64BE(time, sizeof(uint64_t));
+
+                                candidates.emplace(document, std::move(candidate));
+                        }
+                }
+        }
+
+        cursor.close();
+
+        std::vector<Candidate> matches;
+
+        for (auto &entry : candidates) {
+                auto &candidate = entry.second;
+
+                bool found = true;
+                for (std::size_t i = 1; i < words.size() && found; ++i) {
+                        double best = 0;
+                        found       = false;
+
+                        for (const auto &term : words[i].terms) {
+                                const auto other = term.term + '\0' + candidate.document;
+
+                                lmdb::val tf;
+                                if (!lmdb::dbi_get(txn, postingsDb_, lmdb::val(other), tf))
+                                        continue;
+
+                                best  = std::max(best, score(tf, term));
+                                found = true;
+                        }
+
+                        candidate.score += best;
+                }
+
+                if (found)
+                        matches.push_back(std::move(candidate));
+        }
+
+        // Better matches first, then the most recent.
+        const auto count = std::min(limit, matches.size());
+        std::partial_sort(matches.begin(),
+                          matches.begin() + count,
+                          matches.end(),
+                          [](const Candidate &a, const Candidate &b) {
+                                  if (a.score != b.score)
+                                          return a.score > b.score;
+                                  return a.timestamp > b.timestamp;
+                          });
+        matches.resize(count);
+
+        std::vector<MessageSearchResult> results;
+
+        for (const auto &candidate : matches) {
+                const auto separator = candidate.document.find('\0');
+                const auto room      = candidate.document.substr(0, separator);
+                const auto event_id  = candidate.document.substr(separator + 1 + sizeof(uint64_t));
+
+                lmdb::val data;
+                Document doc;
+
+                if (!lmdb::dbi_get(txn, documentsDb_, lmdb::val(room + '\0' + event_id), data) ||
+                    !decodeDocument(data, doc))
+                        continue;
+
+                MessageSearchResult result;
+                result.room_id   = QString::fromStdString(room);
+                result.event_id  = QString::fromStdString(event_id);
+                result.sender    = QString::fromStdString(doc.sender);
+                result.timestamp = doc.timestamp;
+                result.snippet   = snippet(QString::fromStdString(doc.body), tokens);
+                result.score     = candidate.score;
+
+                results.push_back(std::move(result));
+        }
+
+        return results;
+}
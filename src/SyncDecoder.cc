@@ -0,0 +1,82 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits>
+#include <map>
+#include <string>
+
+#include "SyncDecoder.h"
+
+//! Convert the rooms of a section & free their JSON as they are converted.
+template<class Room>
+static void
+decodeRooms(nlohmann::json &rooms, const char *section, std::map<std::string, Room> &result)
+{
+        auto entries = rooms.find(section);
+        if (entries == rooms.end() || !entries->is_object())
+                return;
+
+        for (auto room = entries->begin(); room != entries->end();) {
+                result.emplace(room.key(), room.value().template get<Room>());
+                room = entries->erase(room);
+        }
+}
+
+void
+SyncDecoder::reserve(qint64 size)
+{
+        // The header is only a hint; a compressed response grows past it.
+        if (size > data_.capacity() && size < std::numeric_limits<int>::max())
+                data_.reserve(static_cast<int>(size));
+}
+
+void
+SyncDecoder::append(const QByteArray &chunk)
+{
+        data_.append(chunk);
+}
+
+mtx::responses::Sync
+SyncDecoder::decode()
+{
+        auto response = nlohmann::json::parse(data_.constData(), data_.constData() + data_.size());
+
+        data_.clear();
+        data_.squeeze();
+
+        // Convert everything but the rooms in one go.
+        const auto empty = nlohmann::json::object();
+
+        nlohmann::json rooms;
+
+        auto it = response.find("rooms");
+        if (it != response.end()) {
+                rooms = std::move(*it);
+                *it   = {{"join", empty}, {"invite", empty}, {"leave", empty}};
+        }
+
+        mtx::responses::Sync sync = response;
+
+        // Only the rooms are left.
+        response = nullptr;
+
+        decodeRooms(rooms, "join", sync.rooms.join);
+        decodeRooms(rooms, "invite", sync.rooms.invite);
+        decodeRooms(rooms, "leave", sync.rooms.leave);
+
+        return sync;
+}
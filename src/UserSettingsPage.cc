@@ -196,6 +196,15 @@ UserSettingsPage::UserSettingsPage(QSharedPointer<UserSettings> settings, QWidge
         themeOptionLayout_->addWidget(themeLabel_);
         themeOptionLayout_->addWidget(themeCombo_, 0, Qt::AlignBottom | Qt::AlignRight);
 
+        auto cacheLayout = new QHBoxLayout;
+        cacheLayout->setContentsMargins(0, OptionMargin, 0, OptionMargin);
+        auto cacheLabel      = new QLabel(tr("Reclaim unused cache space"), this);
+        auto compactCacheBtn = new FlatButton(tr("COMPACT"), this);
+        cacheLabel->setStyleSheet("font-size: 15px;");
+
+        cacheLayout->addWidget(cacheLabel);
+        cacheLayout->addWidget(compactCacheBtn, 0, Qt::AlignBottom | Qt::AlignRight);
+
         auto general_ = new QLabel(tr("GENERAL"), this);
         general_->setStyleSheet("font-size: 17px");
 
@@ -216,6 +225,8 @@ UserSettingsPage::UserSettingsPage(QSharedPointer<UserSettings> settings, QWidge
         mainLayout_->addWidget(new HorizontalLine(this));
         mainLayout_->addLayout(themeOptionLayout_);
         mainLayout_->addWidget(new HorizontalLine(this));
+        mainLayout_->addLayout(cacheLayout);
+        mainLayout_->addWidget(new HorizontalLine(this));
 
         topLayout_->addLayout(topBarLayout_);
         topLayout_->addLayout(mainLayout_);
@@ -247,6 +258,8 @@ UserSettingsPage::UserSettingsPage(QSharedPointer<UserSettings> settings, QWidge
                 settings_->setReadReceipts(!isDisabled);
         });
 
+        connect(compactCacheBtn, &QPushButton::clicked, this, &UserSettingsPage::compactCache);
+
         connect(backBtn_, &QPushButton::clicked, this, [this]() {
                 settings_->save();
                 emit moveBack();
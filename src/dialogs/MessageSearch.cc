@@ -0,0 +1,149 @@
+/*
+ * nheko Copyright (C) 2017  Konstantinos Sideris <siderisk@auth.gr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDateTime>
+#include <QKeyEvent>
+#include <QLabel>
+#include <QPainter>
+#include <QStyleOption>
+#include <QVBoxLayout>
+
+#include "Config.h"
+#include "TextField.h"
+#include "dialogs/MessageSearch.h"
+
+using namespace dialogs;
+
+//! Time to wait after the last keystroke before searching.
+constexpr int QUERY_DELAY = 250;
+
+enum ResultRole
+{
+        RoomIdRole = Qt::UserRole,
+        EventIdRole,
+};
+
+MessageSearch::MessageSearch(QWidget *parent)
+  : QFrame(parent)
+{
+        setMinimumWidth(500);
+        setMaximumSize(600, 500);
+
+        auto layout = new QVBoxLayout(this);
+        layout->setSpacing(20);
+        layout->setMargin(20);
+
+        QFont font;
+        font.setPixelSize(conf::headerFontSize);
+
+        auto topLabel = new QLabel(tr("Search messages"), this);
+        topLabel->setAlignment(Qt::AlignCenter);
+        topLabel->setFont(font);
+
+        queryInput_ = new TextField(this);
+        queryInput_->setLabel(tr("Words to find"));
+
+        resultList_ = new QListWidget(this);
+        resultList_->setFrameStyle(QFrame::NoFrame);
+        resultList_->setAttribute(Qt::WA_MacShowFocusRect, 0);
+        resultList_->setWordWrap(true);
+        resultList_->setSpacing(5);
+
+        layout->addWidget(topLabel);
+        layout->addWidget(queryInput_);
+        layout->addWidget(resultList_, 1);
+
+        queryTimer_ = new QTimer(this);
+        queryTimer_->setSingleShot(true);
+        queryTimer_->setInterval(QUERY_DELAY);
+
+        connect(queryInput_, &QLineEdit::textChanged, queryTimer_, [this]() {
+                queryTimer_->start();
+        });
+        connect(queryTimer_, &QTimer::timeout, this, [this]() {
+                emit queryChanged(queryInput_->text());
+        });
+        connect(queryInput_, &QLineEdit::returnPressed, this, [this]() {
+                if (resultList_->count() > 0)
+                        resultList_->setFocus();
+        });
+        connect(resultList_, &QListWidget::itemActivated, this, [this](QListWidgetItem *item) {
+                emit resultSelected(item->data(RoomIdRole).toString(),
+                                    item->data(EventIdRole).toString());
+        });
+}
+
+QString
+MessageSearch::query() const
+{
+        return queryInput_->text();
+}
+
+void
+MessageSearch::setResults(const std::vector<MessageSearchResult> &results,
+                          const QMap<QString, RoomInfo> &rooms)
+{
+        resultList_->clear();
+
+        for (const auto &result : results) {
+                const auto room = rooms.constFind(result.room_id);
+                const auto name =
+                  room != rooms.constEnd() ? QString::fromStdString(room->name) : result.room_id;
+
+                const auto sender = Cache::displayName(result.room_id, result.sender);
+                const auto date   = QDateTime::fromMSecsSinceEpoch(result.timestamp);
+
+                auto item = new QListWidgetItem(resultList_);
+                item->setText(QString("%1 - %2, %3\n%4")
+                                .arg(name)
+                                .arg(sender)
+                                .arg(date.toString("dd/MM/yy HH:mm"))
+                                .arg(result.snippet));
+                item->setData(RoomIdRole, result.room_id);
+                item->setData(EventIdRole, result.event_id);
+        }
+}
+
+void
+MessageSearch::paintEvent(QPaintEvent *)
+{
+        QStyleOption opt;
+        opt.init(this);
+        QPainter p(this);
+        style()->drawPrimitive(QStyle::PE_Widget, &opt, &p, this);
+}
+
+void
+MessageSearch::showEvent(QShowEvent *event)
+{
+        queryInput_->setFocus();
+        queryInput_->selectAll();
+
+        QFrame::showEvent(event);
+}
+
+void
+MessageSearch::keyPressEvent(QKeyEvent *event)
+{
+        if (event->key() == Qt::Key_Escape) {
+                event->accept();
+                emit closing();
+                return;
+        }
+
+        QFrame::keyPressEvent(event);
+}
@@ -16,6 +16,8 @@
  */
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 #include <QDesktopWidget>
 #include <QFile>
 #include <QFontDatabase>
@@ -29,6 +31,7 @@
 #include <QSettings>
 #include <QTranslator>
 
+#include "Cache.h"
 #include "Config.h"
 #include "MainWindow.h"
 #include "RaisedButton.h"
@@ -72,11 +75,83 @@ setupProxy()
         }
 }
 
+//! Export or import the cache of an account without starting the UI.
+//!
+//! Returns the exit code of the process.
+int
+runCacheCommand(const QString &userId, const QString &exportPath, const QString &importPath)
+{
+        if (userId.isEmpty()) {
+                qCritical() << "No account is logged in, select one with --user";
+                return 1;
+        }
+
+        try {
+                Cache cache(userId);
+
+                if (!importPath.isEmpty())
+                        return cache.importSnapshot(importPath) ? 0 : 1;
+
+                cache.setup();
+                cache.runMigrations();
+
+                if (!cache.isFormatValid()) {
+                        qCritical() << "The cache of" << userId << "can't be exported";
+                        return 1;
+                }
+
+                return cache.exportSnapshot(exportPath) ? 0 : 1;
+        } catch (const std::exception &e) {
+                qCritical() << "Cache failure" << e.what();
+        }
+
+        return 1;
+}
+
 int
 main(int argc, char *argv[])
 {
+        QCoreApplication::setApplicationName("nheko");
+        QCoreApplication::setApplicationVersion(nheko::version);
+        QCoreApplication::setOrganizationName("nheko");
+        QCoreApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
+
+        QCommandLineParser parser;
+        QCommandLineOption exportOption(
+          "export-cache", "Export a compacted copy of the cache to <directory>.", "directory");
+        QCommandLineOption importOption(
+          "import-cache", "Replace the cache with the one exported to <directory>.", "directory");
+        QCommandLineOption userOption(
+          "user", "The account of the cache, instead of the logged in one.", "user_id");
+        parser.addOption(exportOption);
+        parser.addOption(importOption);
+        parser.addOption(userOption);
+
+        QStringList arguments;
+        for (int i = 0; i < argc; ++i)
+                arguments << QString::fromLocal8Bit(argv[i]);
+
+        // The options of Qt itself are handled by QApplication.
+        parser.parse(arguments);
+
         RunGuard guard("run_guard");
 
+        if (parser.isSet(exportOption) || parser.isSet(importOption)) {
+                QCoreApplication app(argc, argv);
+
+                if (!guard.tryToRun()) {
+                        qCritical() << "Another instance of nheko is currently running.";
+                        return 1;
+                }
+
+                const auto userId = parser.isSet(userOption)
+                                      ? parser.value(userOption)
+                                      : QSettings().value("auth/user_id").toString();
+
+                return runCacheCommand(
+                  userId, parser.value(exportOption), parser.value(importOption));
+        }
+
         if (!guard.tryToRun()) {
                 QApplication a(argc, argv);
 
@@ -119,11 +194,6 @@ main(int argc, char *argv[])
                 return a.exec();
         }
 
-        QCoreApplication::setApplicationName("nheko");
-        QCoreApplication::setApplicationVersion(nheko::version);
-        QCoreApplication::setOrganizationName("nheko");
-        QCoreApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
-
         QApplication app(argc, argv);
 
         QFontDatabase::addApplicationFont(":/fonts/fonts/OpenSans/OpenSans-Regular.ttf");
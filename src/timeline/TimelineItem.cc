@@ -506,6 +506,27 @@ TimelineItem::setupAvatarLayout(const QString &userName)
         headerLayout_->addWidget(body_);
 }
 
+void
+TimelineItem::refreshSender()
+{
+        if (!userName_ || !userAvatar_)
+                return;
+
+        const auto userid      = descriptionMsg_.userid;
+        const auto displayName = Cache::displayName(room_id_, userid);
+
+        // Still unknown.
+        if (displayName == userid || displayName.isEmpty())
+                return;
+
+        QFontMetrics fm(usernameFont_);
+        userName_->setText(fm.elidedText(displayName, Qt::ElideRight, 500));
+        userAvatar_->setLetter(QChar(displayName[0]).toUpper());
+
+        AvatarProvider::resolve(
+          room_id_, userid, this, [this](const QImage &img) { setUserAvatar(img); });
+}
+
 void
 TimelineItem::setupSimpleLayout()
 {
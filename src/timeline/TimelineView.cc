@@ -17,6 +17,7 @@
 
 #include <QApplication>
 #include <QFileInfo>
+#include <QSet>
 #include <QTimer>
 
 #include "ChatPage.h"
@@ -203,9 +204,17 @@ TimelineView::addBackwardsEvents(const QString &room_id, const mtx::responses::M
         if (room_id_ != room_id)
                 return;
 
+        // The response continues a timeline that was cleared.
+        if (!discardedToken_.isEmpty() && QString::fromStdString(msgs.start) == discardedToken_) {
+                discardedToken_.clear();
+                isPaginationInProgress_ = false;
+                return;
+        }
+
         // We've reached the start of the timline and there're no more messages.
         if ((msgs.end == msgs.start) && msgs.chunk.size() == 0) {
                 isTimelineFinished = true;
+                scrollTarget_.clear();
                 return;
         }
 
@@ -234,6 +243,9 @@ TimelineView::addBackwardsEvents(const QString &room_id, const mtx::responses::M
 
         prev_batch_token_       = QString::fromStdString(msgs.end);
         isPaginationInProgress_ = false;
+
+        if (!scrollTarget_.isEmpty() && isVisible())
+                scrollToEvent(scrollTarget_);
 }
 
 TimelineItem *
@@ -353,6 +365,15 @@ TimelineView::renderTopEvents(const std::vector<TimelineEvent> &events)
 void
 TimelineView::addEvents(const mtx::responses::Timeline &timeline)
 {
+        // There is a gap between the restored events and the new ones.
+        // The timeline starts over from the new batch & the history is
+        // fetched from its token.
+        const bool hasGap = isRestored_ && timeline.limited;
+        if (hasGap)
+                clearTimeline();
+
+        isRestored_ = false;
+
         if (isInitialSync) {
                 prev_batch_token_ = QString::fromStdString(timeline.prev_batch);
                 isInitialSync     = false;
@@ -375,6 +396,49 @@ TimelineView::addEvents(const mtx::responses::Timeline &timeline)
                 if (isActiveWindow())
                         readLastEvent();
         }
+
+        if (hasGap)
+                fetchHistory();
+}
+
+void
+TimelineView::clearTimeline()
+{
+        QSet<QWidget *> pending;
+        for (const auto &msg : pending_msgs_)
+                pending.insert(msg.widget);
+        for (const auto &msg : pending_sent_msgs_)
+                pending.insert(msg.widget);
+
+        // The first item is the stretch that keeps the events at the bottom.
+        int index = 1;
+        while (index < scroll_layout_->count()) {
+                auto widget = scroll_layout_->itemAt(index)->widget();
+
+                if (pending.contains(widget)) {
+                        index += 1;
+                        continue;
+                }
+
+                delete scroll_layout_->takeAt(index);
+
+                if (widget)
+                        widget->deleteLater();
+        }
+
+        if (isPaginationInProgress_)
+                discardedToken_ = prev_batch_token_;
+
+        eventIds_.clear();
+        topMessages_.clear();
+        bottomMessages_.clear();
+        scrollTarget_.clear();
+
+        lastSender_.clear();
+        firstSender_.clear();
+
+        isTimelineFinished = false;
+        isInitialSync      = true;
 }
 
 void
@@ -732,6 +796,56 @@ TimelineView::toggleScrollDownButton()
         }
 }
 
+void
+TimelineView::refreshSenders()
+{
+        for (int i = 0; i < scroll_layout_->count(); ++i) {
+                auto item = qobject_cast<TimelineItem *>(scroll_layout_->itemAt(i)->widget());
+
+                if (item)
+                        item->refreshSender();
+        }
+}
+
+void
+TimelineView::scrollToEvent(const QString &event_id)
+{
+        if (event_id != scrollTarget_) {
+                scrollTarget_ = event_id;
+                scrollPages_  = MAX_SCROLL_PAGES;
+        }
+
+        if (eventIds_.contains(event_id)) {
+                scrollTarget_.clear();
+
+                // Scroll once the layout of the rendered events is updated.
+                QTimer::singleShot(0, this, [this, event_id]() {
+                        if (!eventIds_.contains(event_id))
+                                return;
+
+                        // Keep the event in the middle of the timeline.
+                        const int margin = scroll_area_->viewport()->height() / 2;
+                        scroll_area_->ensureWidgetVisible(eventIds_[event_id], 0, margin);
+                });
+
+                return;
+        }
+
+        if (isTimelineFinished || scrollPages_ == 0) {
+                scrollTarget_.clear();
+                return;
+        }
+
+        // The next page is requested once the current one is rendered.
+        if (isPaginationInProgress_)
+                return;
+
+        scrollPages_ -= 1;
+
+        isPaginationInProgress_ = true;
+        client_->messages(room_id_, prev_batch_token_);
+}
+
 void
 TimelineView::removeEvent(const QString &event_id)
 {
@@ -170,27 +170,34 @@ void
 TimelineViewManager::initialize(const mtx::responses::Rooms &rooms)
 {
         for (auto it = rooms.join.cbegin(); it != rooms.join.cend(); ++it) {
-                addRoom(it->second, QString::fromStdString(it->first));
+                addRoom(it->second.timeline, QString::fromStdString(it->first));
         }
 
         sync(rooms);
 }
 
 void
-TimelineViewManager::initialize(const std::vector<std::string> &rooms)
+TimelineViewManager::initialize(const std::map<QString, mtx::responses::Timeline> &timelines)
 {
-        for (const auto &roomid : rooms)
-                addRoom(QString::fromStdString(roomid));
+        for (const auto &timeline : timelines) {
+                // Rooms without saved events will be populated through /messages.
+                if (timeline.second.events.empty()) {
+                        addRoom(timeline.first);
+                } else {
+                        addRoom(timeline.second, timeline.first);
+                        views_.at(timeline.first)->setRestored();
+                }
+        }
 }
 
 void
-TimelineViewManager::addRoom(const mtx::responses::JoinedRoom &room, const QString &room_id)
+TimelineViewManager::addRoom(const mtx::responses::Timeline &timeline, const QString &room_id)
 {
         if (timelineViewExists(room_id))
                 return;
 
         // Create a history view with the room events.
-        TimelineView *view = new TimelineView(room.timeline, client_, room_id);
+        TimelineView *view = new TimelineView(timeline, client_, room_id);
         views_.emplace(room_id, QSharedPointer<TimelineView>(view));
 
         connect(view,
@@ -255,6 +262,20 @@ TimelineViewManager::setHistoryView(const QString &room_id)
         view->scrollDown();
 }
 
+void
+TimelineViewManager::refreshSenders(const QString &room_id)
+{
+        if (timelineViewExists(room_id))
+                views_.at(room_id)->refreshSenders();
+}
+
+void
+TimelineViewManager::scrollToEvent(const QString &room_id, const QString &event_id)
+{
+        if (timelineViewExists(room_id))
+                views_.at(room_id)->scrollToEvent(event_id);
+}
+
 QString
 TimelineViewManager::chooseRandomColor()
 {
@@ -74,6 +74,7 @@ AudioItem::init()
 }
 
 AudioItem::AudioItem(QSharedPointer<MatrixClient> client,
+                     const QString &room_id,
                      const mtx::events::RoomEvent<mtx::events::msg::Audio> &event,
                      QWidget *parent)
   : QWidget(parent)
@@ -81,6 +82,7 @@ AudioItem::AudioItem(QSharedPointer<MatrixClient> client,
   , text_{QString::fromStdString(event.content.body)}
   , event_{event}
   , client_{client}
+  , room_id_{room_id}
 {
         readableFileSize_ = utils::humanReadableFileSize(event.content.info.size);
 
@@ -88,6 +90,7 @@ AudioItem::AudioItem(QSharedPointer<MatrixClient> client,
 }
 
 AudioItem::AudioItem(QSharedPointer<MatrixClient> client,
+                     const QString &room_id,
                      const QString &url,
                      const QString &filename,
                      uint64_t size,
@@ -96,6 +99,7 @@ AudioItem::AudioItem(QSharedPointer<MatrixClient> client,
   , url_{url}
   , text_{filename}
   , client_{client}
+  , room_id_{room_id}
 {
         readableFileSize_ = utils::humanReadableFileSize(size);
 
@@ -134,7 +138,7 @@ AudioItem::mousePressEvent(QMouseEvent *event)
                 if (filenameToSave_.isEmpty())
                         return;
 
-                auto proxy = client_->downloadFile(url_);
+                auto proxy = client_->downloadFile(url_, room_id_);
                 connect(proxy.data(),
                         &DownloadMediaProxy::fileDownloaded,
                         this,
@@ -60,6 +60,7 @@ FileItem::init()
 }
 
 FileItem::FileItem(QSharedPointer<MatrixClient> client,
+                   const QString &room_id,
                    const mtx::events::RoomEvent<mtx::events::msg::File> &event,
                    QWidget *parent)
   : QWidget(parent)
@@ -67,6 +68,7 @@ FileItem::FileItem(QSharedPointer<MatrixClient> client,
   , text_{QString::fromStdString(event.content.body)}
   , event_{event}
   , client_{client}
+  , room_id_{room_id}
 {
         readableFileSize_ = utils::humanReadableFileSize(event.content.info.size);
 
@@ -74,6 +76,7 @@ FileItem::FileItem(QSharedPointer<MatrixClient> client,
 }
 
 FileItem::FileItem(QSharedPointer<MatrixClient> client,
+                   const QString &room_id,
                    const QString &url,
                    const QString &filename,
                    uint64_t size,
@@ -82,6 +85,7 @@ FileItem::FileItem(QSharedPointer<MatrixClient> client,
   , url_{url}
   , text_{filename}
   , client_{client}
+  , room_id_{room_id}
 {
         readableFileSize_ = utils::humanReadableFileSize(size);
 
@@ -120,7 +124,7 @@ FileItem::mousePressEvent(QMouseEvent *event)
                 if (filenameToSave_.isEmpty())
                         return;
 
-                auto proxy = client_->downloadFile(url_);
+                auto proxy = client_->downloadFile(url_, room_id_);
                 connect(proxy.data(),
                         &DownloadMediaProxy::fileDownloaded,
                         this,
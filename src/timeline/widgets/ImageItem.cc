@@ -30,11 +30,13 @@
 #include "timeline/widgets/ImageItem.h"
 
 ImageItem::ImageItem(QSharedPointer<MatrixClient> client,
+                     const QString &room_id,
                      const mtx::events::RoomEvent<mtx::events::msg::Image> &event,
                      QWidget *parent)
   : QWidget(parent)
   , event_{event}
   , client_{client}
+  , room_id_{room_id}
 {
         setMouseTracking(true);
         setCursor(Qt::PointingHandCursor);
@@ -54,7 +56,7 @@ ImageItem::ImageItem(QSharedPointer<MatrixClient> client,
         url_                 = QString("%1/_matrix/media/r0/download/%2")
                  .arg(client_.data()->getHomeServer().toString(), media_params);
 
-        auto proxy = client_.data()->downloadImage(url_);
+        auto proxy = client_.data()->downloadImage(url_, room_id_);
 
         connect(proxy.data(),
                 &DownloadMediaProxy::imageDownloaded,
@@ -66,6 +68,7 @@ ImageItem::ImageItem(QSharedPointer<MatrixClient> client,
 }
 
 ImageItem::ImageItem(QSharedPointer<MatrixClient> client,
+                     const QString &room_id,
                      const QString &url,
                      const QString &filename,
                      uint64_t size,
@@ -74,6 +77,7 @@ ImageItem::ImageItem(QSharedPointer<MatrixClient> client,
   , url_{url}
   , text_{filename}
   , client_{client}
+  , room_id_{room_id}
 {
         Q_UNUSED(size);
 
@@ -92,7 +96,7 @@ ImageItem::ImageItem(QSharedPointer<MatrixClient> client,
         url_                 = QString("%1/_matrix/media/r0/download/%2")
                  .arg(client_.data()->getHomeServer().toString(), media_params);
 
-        auto proxy = client_.data()->downloadImage(url_);
+        auto proxy = client_.data()->downloadImage(url_, room_id_);
 
         connect(proxy.data(),
                 &DownloadMediaProxy::imageDownloaded,
@@ -233,7 +237,7 @@ ImageItem::saveAs()
         if (filename.isEmpty())
                 return;
 
-        auto proxy = client_->downloadFile(url_);
+        auto proxy = client_->downloadFile(url_, room_id_);
         connect(proxy.data(),
                 &DownloadMediaProxy::fileDownloaded,
                 this,
@@ -38,6 +38,7 @@ VideoItem::init()
 }
 
 VideoItem::VideoItem(QSharedPointer<MatrixClient> client,
+                     const QString &room_id,
                      const mtx::events::RoomEvent<mtx::events::msg::Video> &event,
                      QWidget *parent)
   : QWidget(parent)
@@ -46,6 +47,8 @@ VideoItem::VideoItem(QSharedPointer<MatrixClient> client,
   , event_{event}
   , client_{client}
 {
+        Q_UNUSED(room_id);
+
         readableFileSize_ = utils::humanReadableFileSize(event.content.info.size);
 
         init();
@@ -66,6 +69,7 @@ VideoItem::VideoItem(QSharedPointer<MatrixClient> client,
 }
 
 VideoItem::VideoItem(QSharedPointer<MatrixClient> client,
+                     const QString &room_id,
                      const QString &url,
                      const QString &filename,
                      uint64_t size,
@@ -75,6 +79,8 @@ VideoItem::VideoItem(QSharedPointer<MatrixClient> client,
   , text_{filename}
   , client_{client}
 {
+        Q_UNUSED(room_id);
+
         readableFileSize_ = utils::humanReadableFileSize(size);
 
         init();